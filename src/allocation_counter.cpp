@@ -0,0 +1,79 @@
+#include "allocation_counter.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+    thread_local size_t num_allocations = 0;
+
+    void* allocate(std::size_t size)
+    {
+        ++num_allocations;
+        if (size == 0)
+            size = 1;
+        while (true)
+        {
+            if (void* p = std::malloc(size))
+                return p;
+            const auto handler = std::get_new_handler();
+            if (handler == nullptr)
+                throw std::bad_alloc();
+            handler();
+        }
+    }
+
+    void* allocate_aligned(std::size_t size, const std::align_val_t alignment)
+    {
+        ++num_allocations;
+        const auto align = std::max(static_cast<std::size_t>(alignment), sizeof(void*));
+        // aligned_alloc needs a size that is a multiple of the alignment
+        size = (std::max<std::size_t>(size, 1) + align - 1) / align * align;
+        while (true)
+        {
+            if (void* p = std::aligned_alloc(align, size))
+                return p;
+            const auto handler = std::get_new_handler();
+            if (handler == nullptr)
+                throw std::bad_alloc();
+            handler();
+        }
+    }
+}  // namespace
+
+auto get_thread_allocations() -> size_t
+{
+    return num_allocations;
+}
+
+// The array and nothrow versions of the standard library call these ones.
+void* operator new(std::size_t size)
+{
+    return allocate(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    return allocate_aligned(size, alignment);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
@@ -0,0 +1,12 @@
+#ifndef allocation_counter_h_INCLUDED
+#define allocation_counter_h_INCLUDED
+
+#include <cstddef>
+
+// Number of memory allocations made through operator new by the calling thread since it
+// started.  Linking this library replaces the global operator new, with a thread-local counter
+// that costs one increment per allocation and no synchronization.  It is meant to check that
+// the hot paths, such as the data loaders, do not allocate in the steady state.
+auto get_thread_allocations() -> size_t;
+
+#endif  // allocation_counter_h_INCLUDED
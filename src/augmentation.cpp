@@ -0,0 +1,248 @@
+#include "augmentation.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+using namespace dlib;
+
+namespace
+{
+    auto get_bytes(const matrix<rgb_pixel>& image) -> const unsigned char*
+    {
+        return static_cast<const unsigned char*>(image_data(image));
+    }
+
+    auto get_bytes(matrix<rgb_pixel>& image) -> unsigned char*
+    {
+        return static_cast<unsigned char*>(image_data(image));
+    }
+
+    // out[i] = (a[i] * w + b[i] * (256 - w) + 128) / 256, with w in [0, 256]
+    void blend_bytes(
+        const unsigned char* a,
+        const unsigned char* b,
+        const int w,
+        unsigned char* out,
+        const long size)
+    {
+        long i = 0;
+#if defined(__AVX2__)
+        const __m256i wa = _mm256_set1_epi16(w);
+        const __m256i wb = _mm256_set1_epi16(256 - w);
+        const __m256i half = _mm256_set1_epi16(128);
+        const __m256i zero = _mm256_setzero_si256();
+        for (; i + 32 <= size; i += 32)
+        {
+            const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+            const __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+            // the products fit in 16 unsigned bits: 255 * 256 + 128 < 65536
+            const __m256i lo = _mm256_srli_epi16(
+                _mm256_add_epi16(
+                    _mm256_add_epi16(
+                        _mm256_mullo_epi16(_mm256_unpacklo_epi8(va, zero), wa),
+                        _mm256_mullo_epi16(_mm256_unpacklo_epi8(vb, zero), wb)),
+                    half),
+                8);
+            const __m256i hi = _mm256_srli_epi16(
+                _mm256_add_epi16(
+                    _mm256_add_epi16(
+                        _mm256_mullo_epi16(_mm256_unpackhi_epi8(va, zero), wa),
+                        _mm256_mullo_epi16(_mm256_unpackhi_epi8(vb, zero), wb)),
+                    half),
+                8);
+            // unpack and pack work within 128-bit lanes, so the order is preserved
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_packus_epi16(lo, hi));
+        }
+#endif
+        for (; i < size; ++i)
+            out[i] = (a[i] * w + b[i] * (256 - w) + 128) >> 8;
+    }
+
+    // out[i] = top[i] + fy * (bottom[i] - top[i])
+    void blend_rows(
+        const unsigned char* top,
+        const unsigned char* bottom,
+        const float fy,
+        float* out,
+        const long size)
+    {
+        long i = 0;
+#if defined(__AVX2__)
+        const __m256 vfy = _mm256_set1_ps(fy);
+        for (; i + 8 <= size; i += 8)
+        {
+            const __m256 t = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+                _mm_loadl_epi64(reinterpret_cast<const __m128i*>(top + i))));
+            const __m256 b = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+                _mm_loadl_epi64(reinterpret_cast<const __m128i*>(bottom + i))));
+            _mm256_storeu_ps(out + i, _mm256_add_ps(t, _mm256_mul_ps(vfy, _mm256_sub_ps(b, t))));
+        }
+#endif
+        for (; i < size; ++i)
+            out[i] = top[i] + fy * (bottom[i] - top[i]);
+    }
+
+    // The source position of an output coordinate, as dlib::resize_image maps the corners of
+    // both images onto each other, split into the index of the first sample and the fraction.
+    void get_sample_positions(
+        const long src_size,
+        const long dst_size,
+        std::vector<long>& index,
+        std::vector<float>& frac)
+    {
+        const double scale = (src_size - 1) / static_cast<double>(std::max<long>(dst_size - 1, 1));
+        index.resize(dst_size);
+        frac.resize(dst_size);
+        for (long i = 0; i < dst_size; ++i)
+        {
+            const double p = i * scale;
+            index[i] = std::clamp<long>(std::floor(p), 0, std::max<long>(src_size - 2, 0));
+            frac[i] = src_size > 1 ? p - index[i] : 0;
+        }
+    }
+}  // namespace
+
+void blend_images(
+    const matrix<rgb_pixel>& a,
+    const matrix<rgb_pixel>& b,
+    const double alpha,
+    matrix<rgb_pixel>& output)
+{
+    DLIB_CASSERT(have_same_dimensions(a, b));
+    output.set_size(a.nr(), a.nc());
+    const int w = std::lround(std::clamp(alpha, 0.0, 1.0) * 256);
+    blend_bytes(get_bytes(a), get_bytes(b), w, get_bytes(output), a.size() * 3);
+}
+
+void resize_into(const matrix<rgb_pixel>& image, matrix<rgb_pixel>& output, const rectangle& area)
+{
+    const auto r = area.intersect(get_rect(output));
+    if (r.is_empty() or image.size() == 0)
+        return;
+    // the area is clipped like sub_image does, so the scale uses the clipped size
+    const long nr = r.height();
+    const long nc = r.width();
+    thread_local std::vector<long> x0, y0;
+    thread_local std::vector<float> fx, fy, row;
+    get_sample_positions(image.nc(), nc, x0, fx);
+    get_sample_positions(image.nr(), nr, y0, fy);
+    row.resize(image.nc() * 3);
+    const long row_size = image.nc() * 3;
+    const long next = image.nc() > 1 ? 3 : 0;
+    const long next_row = image.nr() > 1 ? row_size : 0;
+    const auto* src = get_bytes(image);
+    for (long y = 0; y < nr; ++y)
+    {
+        const auto* top = src + y0[y] * row_size;
+        blend_rows(top, top + next_row, fy[y], row.data(), row_size);
+        auto* out = reinterpret_cast<unsigned char*>(&output(r.top() + y, r.left()));
+        for (long x = 0; x < nc; ++x, out += 3)
+        {
+            const float* p = row.data() + x0[x] * 3;
+            const float f = fx[x];
+            out[0] = static_cast<unsigned char>(p[0] + f * (p[next] - p[0]) + 0.5f);
+            out[1] = static_cast<unsigned char>(p[1] + f * (p[next + 1] - p[1]) + 0.5f);
+            out[2] = static_cast<unsigned char>(p[2] + f * (p[next + 2] - p[2]) + 0.5f);
+        }
+    }
+}
+
+auto get_letterbox_transform(const long nr, const long nc, const long size)
+    -> point_transform_affine
+{
+    const double scale = size / static_cast<double>(std::max(nr, nc));
+    const long dr = (size - std::lround(scale * nr)) / 2;
+    const long dc = (size - std::lround(scale * nc)) / 2;
+    return point_transform_affine(identity_matrix<double>(2) * scale, dpoint(dc, dr));
+}
+
+auto get_perspective_transform(
+    const std::array<dpoint, 4>& from,
+    const std::array<dpoint, 4>& to) -> point_transform_projective
+{
+    // Each pair of points gives two equations on the 8 unknown coefficients of the transform,
+    // the last one being 1:
+    //   h0 x + h1 y + h2 - h6 x u - h7 y u = u
+    //   h3 x + h4 y + h5 - h6 x v - h7 y v = v
+    std::array<std::array<double, 9>, 8> a{};
+    for (size_t i = 0; i < 4; ++i)
+    {
+        const double x = from[i].x(), y = from[i].y();
+        const double u = to[i].x(), v = to[i].y();
+        a[2 * i] = {x, y, 1, 0, 0, 0, -x * u, -y * u, u};
+        a[2 * i + 1] = {0, 0, 0, x, y, 1, -x * v, -y * v, v};
+    }
+    // Gaussian elimination with partial pivoting
+    for (size_t c = 0; c < 8; ++c)
+    {
+        size_t pivot = c;
+        for (size_t r = c + 1; r < 8; ++r)
+        {
+            if (std::abs(a[r][c]) > std::abs(a[pivot][c]))
+                pivot = r;
+        }
+        std::swap(a[c], a[pivot]);
+        if (a[c][c] == 0)
+            throw std::invalid_argument("ERROR: degenerate points for a perspective transform");
+        for (size_t r = 0; r < 8; ++r)
+        {
+            if (r == c)
+                continue;
+            const double f = a[r][c] / a[c][c];
+            for (size_t k = c; k < 9; ++k)
+                a[r][k] -= f * a[c][k];
+        }
+    }
+    matrix<double, 3, 3> m;
+    for (size_t i = 0; i < 8; ++i)
+        m(i / 3, i % 3) = a[i][8] / a[i][i];
+    m(2, 2) = 1;
+    return point_transform_projective(m);
+}
+
+void warp_image(
+    const matrix<rgb_pixel>& image,
+    const point_transform_projective& output_to_image,
+    matrix<rgb_pixel>& output,
+    const long nr,
+    const long nc)
+{
+    output.set_size(nr, nc);
+    const auto& m = output_to_image.get_m();
+    const auto* src = get_bytes(image);
+    const long row_size = image.nc() * 3;
+    const float max_x = image.nc() - 1;
+    const float max_y = image.nr() - 1;
+    for (long y = 0; y < nr; ++y)
+    {
+        auto* out = get_bytes(output) + y * nc * 3;
+        // the homogeneous coordinates in the image move by a constant step along a row
+        double u = m(0, 1) * y + m(0, 2);
+        double v = m(1, 1) * y + m(1, 2);
+        double w = m(2, 1) * y + m(2, 2);
+        for (long x = 0; x < nc; ++x, out += 3, u += m(0, 0), v += m(1, 0), w += m(2, 0))
+        {
+            const float px = u / w;
+            const float py = v / w;
+            // the same bounds as interpolate_bilinear: the 4 neighbors must be in the image
+            if (not(px >= 0 and py >= 0 and px < max_x and py < max_y))
+            {
+                out[0] = out[1] = out[2] = 0;
+                continue;
+            }
+            const long x0 = px;
+            const long y0 = py;
+            const float fx = px - x0;
+            const float fy = py - y0;
+            const auto* tl = src + y0 * row_size + x0 * 3;
+            const auto* bl = tl + row_size;
+            for (int c = 0; c < 3; ++c)
+            {
+                const float t = tl[c] + fx * (tl[c + 3] - tl[c]);
+                const float b = bl[c] + fx * (bl[c + 3] - bl[c]);
+                out[c] = static_cast<unsigned char>(t + fy * (b - t) + 0.5f);
+            }
+        }
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef augmentation_h_INCLUDED
+#define augmentation_h_INCLUDED
+
+#include <dlib/image_transforms.h>
+
+// Image kernels of the data augmentation, working on the interleaved 8-bit pixels.  They use
+// AVX2 when the build enables it, and scalar code otherwise.
+
+// Mixup of two images of the same size: alpha * a + (1 - alpha) * b for each channel.  The
+// weights are quantized to 1/256, so the result may differ by one level from a computation in
+// double precision.
+void blend_images(
+    const dlib::matrix<dlib::rgb_pixel>& a,
+    const dlib::matrix<dlib::rgb_pixel>& b,
+    const double alpha,
+    dlib::matrix<dlib::rgb_pixel>& output);
+
+// Bilinear resize of the image into the area of the output, clipped to the output, like
+// dlib::resize_image(image, sub_image(output, area)) but in two separable passes: the two
+// source rows of each output row are blended with SIMD, then the columns are interpolated.
+void resize_into(
+    const dlib::matrix<dlib::rgb_pixel>& image,
+    dlib::matrix<dlib::rgb_pixel>& output,
+    const dlib::rectangle& area);
+
+// The transform of dlib::letterbox_image for an image of nr x nc pixels, without resampling it
+auto get_letterbox_transform(const long nr, const long nc, const long size)
+    -> dlib::point_transform_affine;
+
+// The projective transform that maps the 4 points to the 4 others, like
+// dlib::find_projective_transform but without allocating any memory.
+auto get_perspective_transform(
+    const std::array<dlib::dpoint, 4>& from,
+    const std::array<dlib::dpoint, 4>& to) -> dlib::point_transform_projective;
+
+// Resamples the image into a nr x nc output in a single bilinear pass, at the positions given
+// by the transform of each output pixel.  The pixels that fall outside of the image are black,
+// like with dlib::transform_image and dlib::interpolate_bilinear.
+void warp_image(
+    const dlib::matrix<dlib::rgb_pixel>& image,
+    const dlib::point_transform_projective& output_to_image,
+    dlib::matrix<dlib::rgb_pixel>& output,
+    const long nr,
+    const long nc);
+
+#endif  // augmentation_h_INCLUDED
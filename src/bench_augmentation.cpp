@@ -0,0 +1,153 @@
+#include "augmentation.h"
+
+#include <dlib/cmd_line_parser.h>
+#include <dlib/rand.h>
+
+using namespace dlib;
+using fms = std::chrono::duration<float, std::milli>;
+using rgb_image = matrix<rgb_pixel>;
+
+namespace
+{
+    // the mixup loop that was used by train
+    void blend_images_reference(
+        const rgb_image& a,
+        const rgb_image& b,
+        const double alpha,
+        rgb_image& output)
+    {
+        output.set_size(a.nr(), a.nc());
+        for (long r = 0; r < output.nr(); ++r)
+        {
+            for (long c = 0; c < output.nc(); ++c)
+            {
+                output(r, c).red = alpha * a(r, c).red + (1 - alpha) * b(r, c).red;
+                output(r, c).green = alpha * a(r, c).green + (1 - alpha) * b(r, c).green;
+                output(r, c).blue = alpha * a(r, c).blue + (1 - alpha) * b(r, c).blue;
+            }
+        }
+    }
+
+    auto max_difference(const rgb_image& a, const rgb_image& b) -> int
+    {
+        DLIB_CASSERT(have_same_dimensions(a, b));
+        int diff = 0;
+        for (long r = 0; r < a.nr(); ++r)
+        {
+            for (long c = 0; c < a.nc(); ++c)
+            {
+                diff = std::max(diff, std::abs(a(r, c).red - b(r, c).red));
+                diff = std::max(diff, std::abs(a(r, c).green - b(r, c).green));
+                diff = std::max(diff, std::abs(a(r, c).blue - b(r, c).blue));
+            }
+        }
+        return diff;
+    }
+
+    // a smooth image with some noise, so that interpolation errors are visible
+    auto make_image(dlib::rand& rnd, const long size) -> rgb_image
+    {
+        rgb_image image(size, size);
+        for (long r = 0; r < size; ++r)
+        {
+            for (long c = 0; c < size; ++c)
+            {
+                const auto noise = rnd.get_random_32bit_number() % 32;
+                image(r, c).red = (r + noise) % 256;
+                image(r, c).green = (c * 2 + noise) % 256;
+                image(r, c).blue = (r + c + noise) % 256;
+            }
+        }
+        return image;
+    }
+
+    // the kernels round where the previous code truncated
+    constexpr int max_allowed_difference = 1;
+
+    template <typename F> auto time_ms(const size_t iterations, F&& f) -> float
+    {
+        const auto t0 = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; ++i)
+            f();
+        const auto t1 = std::chrono::steady_clock::now();
+        return std::chrono::duration_cast<fms>(t1 - t0).count() / iterations;
+    }
+}  // namespace
+
+auto main(const int argc, const char** argv) -> int
+try
+{
+    command_line_parser parser;
+    parser.add_option("size", "image size (default: 512)", 1);
+    parser.add_option("iterations", "number of runs of each method (default: 100)", 1);
+    parser.set_group_name("Help Options");
+    parser.add_option("h", "alias for --help");
+    parser.add_option("help", "display this message and exit");
+    parser.parse(argc, argv);
+
+    if (parser.option("h") or parser.option("help"))
+    {
+        std::cout << "Benchmark of the augmentation kernels against the previous code\n";
+        std::cout << "Fails if their outputs differ by more than one level\n";
+        parser.print_options();
+        return EXIT_SUCCESS;
+    }
+    parser.check_option_arg_range<long>("size", 2, 8192);
+
+    const long size = get_option(parser, "size", 512);
+    const size_t iterations = get_option(parser, "iterations", 100);
+    dlib::rand rnd(0);
+    const auto a = make_image(rnd, size);
+    const auto b = make_image(rnd, size);
+    rgb_image reference, output;
+
+    // mixup
+    const double alpha = 0.37;
+    const auto blend_ref_ms =
+        time_ms(iterations, [&]() { blend_images_reference(a, b, alpha, reference); });
+    const auto blend_ms = time_ms(iterations, [&]() { blend_images(a, b, alpha, output); });
+    const auto blend_diff = max_difference(reference, output);
+    std::cout << "mixup blend:  " << blend_ref_ms << " ms -> " << blend_ms << " ms ("
+              << blend_ref_ms / blend_ms << "x), max difference: " << blend_diff << '\n';
+
+    // mosaic tiles, including the ones clipped by the border of the image
+    const long s = size / 2;
+    const std::vector<std::pair<long, long>> pos{{0, 0}, {0, s}, {s, 0}, {s, s}};
+    reference.set_size(size, size);
+    output.set_size(size, size);
+    assign_all_pixels(reference, rgb_pixel(0, 0, 0));
+    assign_all_pixels(output, rgb_pixel(0, 0, 0));
+    const auto resize_ref_ms = time_ms(
+        iterations,
+        [&]()
+        {
+            for (const auto& [x, y] : pos)
+            {
+                auto si = sub_image(reference, rectangle(x, y, x + s, y + s));
+                resize_image(a, si);
+            }
+        });
+    const auto resize_ms = time_ms(
+        iterations,
+        [&]()
+        {
+            for (const auto& [x, y] : pos)
+                resize_into(a, output, rectangle(x, y, x + s, y + s));
+        });
+    const auto resize_diff = max_difference(reference, output);
+    std::cout << "mosaic tiles: " << resize_ref_ms << " ms -> " << resize_ms << " ms ("
+              << resize_ref_ms / resize_ms << "x), max difference: " << resize_diff << '\n';
+
+    if (blend_diff > max_allowed_difference or resize_diff > max_allowed_difference)
+    {
+        std::cerr << "ERROR: the kernels differ from the previous code by more than "
+                  << max_allowed_difference << " level\n";
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+catch (const std::exception& e)
+{
+    std::cerr << e.what() << '\n';
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,123 @@
+#include "nms.h"
+
+#include <dlib/cmd_line_parser.h>
+
+using namespace dlib;
+using fms = std::chrono::duration<float, std::milli>;
+
+auto main(const int argc, const char** argv) -> int
+try
+{
+    command_line_parser parser;
+    parser.add_option("boxes", "number of candidate boxes (default: 10000)", 1);
+    parser.add_option("classes", "number of classes (default: 80)", 1);
+    parser.add_option("width", "width of the image (default: 1920)", 1);
+    parser.add_option("height", "height of the image (default: 1080)", 1);
+    parser.add_option("nms", "IoU and area covered thresholds (default: 0.45 1)", 2);
+    parser.add_option("no-classwise", "disable classwise NMS");
+    parser.add_option("iterations", "number of runs of each method (default: 10)", 1);
+    parser.set_group_name("Help Options");
+    parser.add_option("h", "alias for --help");
+    parser.add_option("help", "display this message and exit");
+    parser.parse(argc, argv);
+
+    if (parser.option("h") or parser.option("help"))
+    {
+        std::cout << "Benchmark of the grid NMS against the linear scan of loss_yolo\n";
+        parser.print_options();
+        return EXIT_SUCCESS;
+    }
+    parser.check_option_arg_range<long>("boxes", 1, 10'000'000);
+    parser.check_option_arg_range<long>("classes", 1, 10'000);
+    parser.check_option_arg_range<double>("nms", 0, 1);
+
+    const size_t num_boxes = get_option(parser, "boxes", 10000);
+    const size_t num_classes = get_option(parser, "classes", 80);
+    const double width = get_option(parser, "width", 1920);
+    const double height = get_option(parser, "height", 1080);
+    const size_t iterations = get_option(parser, "iterations", 10);
+    const bool classwise = not parser.option("no-classwise");
+    double iou_threshold = 0.45;
+    double ratio_covered = 1.0;
+    if (parser.option("nms"))
+    {
+        iou_threshold = std::stod(parser.option("nms").argument(0));
+        ratio_covered = std::stod(parser.option("nms").argument(1));
+    }
+    const test_box_overlap overlaps(iou_threshold, ratio_covered);
+
+    // a crowded scene: clusters of boxes around some objects, like at a low confidence
+    dlib::rand rnd(0);
+    std::vector<yolo_rect> candidates;
+    candidates.reserve(num_boxes);
+    const size_t num_objects = std::max<size_t>(num_boxes / 20, 1);
+    std::vector<drectangle> objects;
+    std::vector<std::string> labels;
+    for (size_t i = 0; i < num_objects; ++i)
+    {
+        labels.push_back(std::to_string(rnd.get_random_32bit_number() % num_classes));
+        const auto w = 8 + rnd.get_random_double() * width / 10;
+        const auto h = 8 + rnd.get_random_double() * height / 10;
+        const dpoint center(rnd.get_random_double() * width, rnd.get_random_double() * height);
+        objects.push_back(centered_drect(center, w, h));
+    }
+    for (size_t i = 0; i < num_boxes; ++i)
+    {
+        const auto o = rnd.get_random_32bit_number() % objects.size();
+        const auto& object = objects[o];
+        const dpoint jitter(
+            rnd.get_random_gaussian() * object.width() / 8,
+            rnd.get_random_gaussian() * object.height() / 8);
+        const auto scale = std::exp(rnd.get_random_gaussian() * 0.2);
+        yolo_rect det(centered_drect(
+            center(object) + jitter,
+            object.width() * scale,
+            object.height() * scale));
+        det.detection_confidence = rnd.get_random_double();
+        // most candidates agree on the class of the object
+        if (rnd.get_random_double() < 0.8)
+            det.label = labels[o];
+        else
+            det.label = std::to_string(rnd.get_random_32bit_number() % num_classes);
+        candidates.push_back(std::move(det));
+    }
+
+    std::vector<yolo_rect> linear, grid;
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+    {
+        linear = candidates;
+        non_max_suppression(linear, overlaps, classwise, nms_algorithm::linear);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    const auto linear_ms = std::chrono::duration_cast<fms>(t1 - t0).count() / iterations;
+
+    t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+    {
+        grid = candidates;
+        non_max_suppression(grid, overlaps, classwise, nms_algorithm::grid);
+    }
+    t1 = std::chrono::steady_clock::now();
+    const auto grid_ms = std::chrono::duration_cast<fms>(t1 - t0).count() / iterations;
+
+    bool same = linear.size() == grid.size();
+    for (size_t i = 0; same and i < linear.size(); ++i)
+        same = linear[i].rect == grid[i].rect and linear[i].label == grid[i].label;
+
+    std::cout << "candidates: " << num_boxes << ", kept: " << grid.size() << '\n';
+    std::cout << "linear NMS: " << linear_ms << " ms\n";
+    std::cout << "grid NMS:   " << grid_ms << " ms\n";
+    std::cout << "speedup: " << linear_ms / grid_ms << "x\n";
+    if (not same)
+    {
+        std::cout << "WARNING: the methods kept different boxes\n";
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+catch (const std::exception& e)
+{
+    std::cerr << e.what() << '\n';
+    return EXIT_FAILURE;
+}
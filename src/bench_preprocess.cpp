@@ -0,0 +1,107 @@
+#include "detector_utils.h"
+
+#include <dlib/cmd_line_parser.h>
+#include <dlib/dnn.h>
+
+using namespace dlib;
+using fms = std::chrono::duration<float, std::milli>;
+
+// the baseline rounds the resized image to 8 bits, so they differ by up to 0.5 / 256, plus the
+// rounding of the floats
+constexpr float max_allowed_difference = 0.5f / 256 + 1e-5f;
+
+auto main(const int argc, const char** argv) -> int
+try
+{
+    command_line_parser parser;
+    parser.add_option("width", "width of the random input image (default: 1920)", 1);
+    parser.add_option("height", "height of the random input image (default: 1080)", 1);
+    parser.add_option("size", "image size for inference (default: 512)", 1);
+    parser.add_option("iterations", "number of runs of each method (default: 200)", 1);
+    parser.add_option("letterbox", "letterbox the image instead of resizing it");
+    parser.set_group_name("Help Options");
+    parser.add_option("h", "alias for --help");
+    parser.add_option("help", "display this message and exit");
+    parser.parse(argc, argv);
+
+    if (parser.option("h") or parser.option("help"))
+    {
+        std::cout << "Benchmark of the fused preprocessing against preprocess_image + to_tensor\n";
+        std::cout << "Fails if their outputs differ by more than the rounding to 8 bits\n";
+        parser.print_options();
+        return EXIT_SUCCESS;
+    }
+    parser.check_option_arg_range<long>("width", 1, 16384);
+    parser.check_option_arg_range<long>("height", 1, 16384);
+    parser.check_option_arg_range<long>("size", 32, 8192);
+
+    const long width = get_option(parser, "width", 1920);
+    const long height = get_option(parser, "height", 1080);
+    const long image_size = get_option(parser, "size", 512);
+    const size_t iterations = get_option(parser, "iterations", 200);
+    const bool use_letterbox = parser.option("letterbox");
+
+#if defined(__AVX512F__)
+    std::cout << "kernel: AVX-512\n";
+#elif defined(__AVX2__)
+    std::cout << "kernel: AVX2\n";
+#else
+    std::cout << "kernel: scalar\n";
+#endif
+
+    matrix<rgb_pixel> image(height, width);
+    dlib::rand rnd(0);
+    for (auto& p : image)
+    {
+        p.red = rnd.get_random_8bit_number();
+        p.green = rnd.get_random_8bit_number();
+        p.blue = rnd.get_random_8bit_number();
+    }
+
+    const input_rgb_image input;
+    const std::array<float, 3> means{
+        input.get_avg_red(),
+        input.get_avg_green(),
+        input.get_avg_blue()};
+
+    matrix<rgb_pixel> resized;
+    resizable_tensor baseline, fused;
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+    {
+        preprocess_image(image, resized, image_size, use_letterbox);
+        input.to_tensor(&resized, &resized + 1, baseline);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    const auto baseline_ms = std::chrono::duration_cast<fms>(t1 - t0).count() / iterations;
+
+    t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+        preprocess_image(image, fused, means, image_size, use_letterbox);
+    t1 = std::chrono::steady_clock::now();
+    const auto fused_ms = std::chrono::duration_cast<fms>(t1 - t0).count() / iterations;
+
+    std::cout << "input: " << width << 'x' << height << ", output: " << fused.nc() << 'x'
+              << fused.nr() << (use_letterbox ? " (letterbox)" : "") << '\n';
+    std::cout << "preprocess_image + to_tensor: " << baseline_ms << " ms\n";
+    std::cout << "fused preprocess_image:       " << fused_ms << " ms\n";
+    std::cout << "speedup: " << baseline_ms / fused_ms << "x\n";
+    if (not have_same_dimensions(baseline, fused))
+    {
+        std::cerr << "ERROR: the outputs have different dimensions\n";
+        return EXIT_FAILURE;
+    }
+    const float difference = max(abs(mat(baseline) - mat(fused)));
+    std::cout << "max abs difference: " << difference << '\n';
+    if (not(difference <= max_allowed_difference))
+    {
+        std::cerr << "ERROR: the outputs differ by more than " << max_allowed_difference << '\n';
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+catch (const std::exception& e)
+{
+    std::cerr << e.what() << '\n';
+    return EXIT_FAILURE;
+}
@@ -1,6 +1,8 @@
 #include "detector_utils.h"
 #include "draw.h"
+#include "inference_engine.h"
 #include "model.h"
+#include "pseudo_labels.h"
 #include "sgd_trainer.h"
 #include "webcam_window.h"
 
@@ -32,13 +34,19 @@ const std::unordered_set<std::string> image_exts{
 auto main(const int argc, const char** argv) -> int
 try
 {
+    const auto num_threads = std::thread::hardware_concurrency();
+    const auto num_threads_str = std::to_string(num_threads);
     command_line_parser parser;
     parser.set_group_name("Detector Options");
+    parser.add_option("arch", "network architecture if not in the file (default: yolov7)", 1);
+    parser.add_option("bf16", "fuse the network and run it with bfloat16 weights");
     parser.add_option("conf", "detection confidence threshold (default: 0.25)", 1);
     parser.add_option("dnn", "load this network file", 1);
     parser.add_option("fuse", "fuse network layers and save the net", 1);
     parser.add_option("nms", "IoU and area covered thresholds (default: 0.45 1)", 2);
     parser.add_option("no-classwise", "disable classwise NMS");
+    parser.add_option("nms-grid", "use the grid NMS, faster on crowded scenes");
+    parser.add_option("shared", "attach to the network published in shared memory as <arg>", 1);
     parser.add_option("size", "image long side for inference (default: 512)", 1);
     parser.add_option("sync", "load this sync file", 1);
 
@@ -65,10 +73,17 @@ try
     parser.add_option("webcam", "webcam device to use (default: 0)", 1);
     parser.add_option("quality", "lossy image quality factor (0...100)", 1);
 
+    parser.set_group_name("Throughput Options");
+    parser.add_option("batch", "batch size for --images and --pseudo (default: 8)", 1);
+    parser.add_option("decoders", "decoding threads (default: " + num_threads_str + ")", 1);
+    parser.add_option("encoders", "encoding threads (default: " + num_threads_str + ")", 1);
+
     parser.set_group_name("Pseudo-labelling Options");
     parser.add_option("dry-run", "check that all files in the dataset exist");
     parser.add_option("pseudo", "update this dataset with pseudo-labels", 1);
     parser.add_option("overlap", "overlap between truth and pseudo-labels", 2);
+    parser.add_option("shard", "only label the images of shard i out of N (default: 0/1)", 1);
+    parser.add_option("merge", "merge the pseudo-labels of N shards into the dataset", 1);
 
     parser.set_group_name("Help Options");
     parser.add_option("architecture", "print the network architecture and exit");
@@ -83,7 +98,7 @@ try
         return EXIT_SUCCESS;
     }
 
-    model net;
+    model net(get_option(parser, "arch", "yolov7"));
 
     if (parser.option("architecture"))
     {
@@ -102,6 +117,8 @@ try
     }
 
     parser.check_incompatible_options("dnn", "sync");
+    parser.check_incompatible_options("dnn", "shared");
+    parser.check_incompatible_options("sync", "shared");
     parser.check_incompatible_options("no-labels", "multilabel");
     parser.check_incompatible_options("no-labels", "font");
     parser.check_incompatible_options("no-labels", "offset");
@@ -116,13 +133,19 @@ try
     parser.check_sub_option("output", "quality");
     parser.check_sub_option("pseudo", "overlap");
     parser.check_sub_option("pseudo", "dry-run");
+    parser.check_sub_option("pseudo", "shard");
+    parser.check_sub_option("pseudo", "merge");
+    parser.check_incompatible_options("shard", "merge");
+    parser.check_option_arg_range<unsigned long>("merge", 1, 1'000'000);
 
     const long image_size = get_option(parser, "size", 512);
     const double conf_thresh = get_option(parser, "conf", 0.25);
     const fs::path dnn_path = get_option(parser, "dnn", "");
     const fs::path sync_path = get_option(parser, "sync", "");
+    const std::string shared_name = get_option(parser, "shared", "");
     const fs::path font_path = get_option(parser, "font", "");
     const bool classwise_nms = not parser.option("no-classwise");
+    const auto nms = parser.option("nms-grid") ? nms_algorithm::grid : nms_algorithm::linear;
     const size_t webcam_index = get_option(parser, "webcam", 0);
     const fs::path input_path = get_option(parser, "input", "");
     fs::path output_path = get_option(parser, "output", "");
@@ -132,6 +155,9 @@ try
     const bool use_letterbox = parser.option("letterbox");
     const float quality = get_option(parser, "quality", 101.f);
     float fps = get_option(parser, "fps", 30);
+    const size_t batch_size = get_option(parser, "batch", 8);
+    const size_t num_decoders = std::max<size_t>(get_option(parser, "decoders", num_threads), 1);
+    const size_t num_encoders = std::max<size_t>(get_option(parser, "encoders", num_threads), 1);
     double nms_iou_threshold = 0.45;
     double nms_ratio_covered = 1.0;
     if (parser.option("nms"))
@@ -146,11 +172,15 @@ try
         text_offset.y() = std::stoi(parser.option("offset").argument(1));
     }
 
-    // Try to load the network from either a weights file or a trainer state
+    // Try to load the network from either a weights file, shared memory or a trainer state
     if (not dnn_path.empty())
     {
         net.load_infer(dnn_path);
     }
+    else if (not shared_name.empty())
+    {
+        net.load_shared(shared_name);
+    }
     else if (not sync_path.empty() and file_exists(sync_path))
     {
         auto trainer = sgd_trainer(net);
@@ -165,6 +195,13 @@ try
         return EXIT_FAILURE;
     }
 
+    // The networks saved with reduced precision or packed weights are already fused and converted
+    if (parser.option("bf16") and net.get_precision() == inference_precision::fp32)
+    {
+        net.fuse();
+        net.quantize(inference_precision::bf16);
+    }
+
     // General options for drawing bounding boxes on images
     drawing_options options;
     options.set_font(font_path);
@@ -222,7 +259,7 @@ try
         serialize(parser.option("save-options").argument()) << options;
 
     // Setup the loss nms
-    net.adjust_nms(nms_iou_threshold, nms_ratio_covered, classwise_nms);
+    net.adjust_nms(nms_iou_threshold, nms_ratio_covered, classwise_nms, nms);
     // Get the maximum network stride
     const auto stride = net.get_strides(image_size).back();
     net.print_loss_details();
@@ -241,8 +278,8 @@ try
         const bool check_dataset = parser.option("dry-run");
         image_dataset_metadata::dataset dataset;
         load_image_dataset_metadata(dataset, dataset_path);
+        const auto dataset_file = fs::absolute(dataset_path).string();
         locally_change_current_dir chdir(dataset_path.parent_path());
-        rgb_image image, resized;
         double overlap_iou_threshold = 0.45;
         double overlap_ratio_covered = 1;
         if (parser.option("overlap"))
@@ -251,34 +288,183 @@ try
             overlap_ratio_covered = std::stod(parser.option("overlap").argument(1));
         }
         test_box_overlap overlaps(overlap_iou_threshold, overlap_ratio_covered);
-        console_progress_indicator progress(dataset.images.size());
-        for (size_t i = 0; i < dataset.images.size(); ++i)
+        if (check_dataset)
         {
-            auto& image_info = dataset.images[i];
-            if (check_dataset)
+            for (const auto& image_info : dataset.images)
             {
                 if (not fs::exists(image_info.filename))
                     std::clog << image_info.filename << '\n';
-                continue;
             }
-            load_image(image, image_info.filename);
-            image_info.width = image.nc();
-            image_info.height = image.nr();
-            const auto tform = preprocess_image(image, resized, image_size, use_letterbox, stride);
-            auto detections = net(resized, conf_thresh);
-            postprocess_detections(tform, detections);
-            for (const auto& pseudo : detections)
+            chdir.revert();
+            save_image_dataset_metadata(dataset, dataset_path.replace_extension("-pseudo.xml"));
+            return EXIT_SUCCESS;
+        }
+
+        // The shards and their checkpoints can only be merged if they used the same settings.
+        unsigned long shard = 0, num_shards = get_option(parser, "merge", 1);
+        if (parser.option("shard"))
+        {
+            const auto arg = parser.option("shard").argument();
+            const auto slash = arg.find('/');
+            if (slash == std::string::npos)
+                throw std::runtime_error("ERROR: --shard expects i/N, got " + arg);
+            shard = std::stoul(arg.substr(0, slash));
+            num_shards = std::stoul(arg.substr(slash + 1));
+            if (num_shards == 0 or shard >= num_shards)
+                throw std::runtime_error("ERROR: --shard expects 0 <= i < N, got " + arg);
+        }
+        std::ostringstream sout;
+        sout << net.get_architecture() << ' ' << fs::path(dnn_path).filename().string() << ' '
+             << fs::path(sync_path).filename().string() << " size " << image_size << " conf "
+             << conf_thresh << " letterbox " << use_letterbox << " nms " << nms_iou_threshold
+             << ' ' << nms_ratio_covered << ' ' << classwise_nms << " overlap "
+             << overlap_iou_threshold << ' ' << overlap_ratio_covered << " shards " << num_shards;
+        const auto settings = sout.str();
+
+        if (parser.option("merge"))
+        {
+            size_t num_labelled = 0;
+            for (unsigned long i = 0; i < num_shards; ++i)
+            {
+                const auto path = get_checkpoint_path(dataset_file, i, num_shards);
+                const auto labels = read_pseudo_checkpoint(path, settings);
+                num_labelled += merge_pseudo_labels(dataset, labels);
+            }
+            if (num_labelled != dataset.images.size())
+                std::clog << "WARNING: only " << num_labelled << " out of "
+                          << dataset.images.size() << " images were pseudo-labelled\n";
+            chdir.revert();
+            save_image_dataset_metadata(dataset, dataset_path.replace_extension("-pseudo.xml"));
+            return EXIT_SUCCESS;
+        }
+
+        // Resume from the checkpoint of this shard, which is updated after each chunk.
+        const auto checkpoint_path = get_checkpoint_path(dataset_file, shard, num_shards);
+        pseudo_checkpoint checkpoint(checkpoint_path, settings);
+        std::vector<bool> done(dataset.images.size(), false);
+        for (const auto& item : checkpoint.get_labels())
+            done.at(item.index) = true;
+        std::vector<size_t> todo;
+        for (size_t i = shard; i < dataset.images.size(); i += num_shards)
+        {
+            if (not done[i])
+                todo.push_back(i);
+        }
+        if (not checkpoint.get_labels().empty())
+            std::clog << "resuming " << checkpoint_path << ": " << todo.size()
+                      << " images left in shard " << shard << '/' << num_shards << '\n';
+
+        // The images are processed in chunks of a fixed size: the decoders prepare the next
+        // chunk while the network runs on the current one.  Each chunk is split into batches
+        // by image size and dataset order only, so the labels do not depend on the threads.
+        struct pseudo_sample
+        {
+            rgb_image image;
+            rectangle_transform tform;
+            long width = 0;
+            long height = 0;
+            bool loaded = false;
+        };
+        const size_t chunk_size = 16 * batch_size;
+        std::vector<pseudo_sample> current(chunk_size), next(chunk_size);
+        const auto decode_chunk = [&](std::vector<pseudo_sample>& samples, const size_t begin)
+        {
+            const size_t end = std::min(begin + chunk_size, todo.size());
+            parallel_for(
+                num_decoders,
+                begin,
+                end,
+                [&](const size_t j)
+                {
+                    auto& sample = samples[j - begin];
+                    const auto& image_info = dataset.images[todo[j]];
+                    rgb_image image;
+                    sample.loaded = false;
+                    try
+                    {
+                        load_image(image, image_info.filename);
+                    }
+                    catch (const std::exception& e)
+                    {
+                        std::cerr << "ERROR: " << image_info.filename << ": " << e.what() << '\n';
+                        return;
+                    }
+                    sample.width = image.nc();
+                    sample.height = image.nr();
+                    sample.tform =
+                        preprocess_image(image, sample.image, image_size, use_letterbox, stride);
+                    sample.loaded = true;
+                });
+        };
+
+        console_progress_indicator progress(todo.size());
+        if (not todo.empty())
+            decode_chunk(current, 0);
+        for (size_t begin = 0; begin < todo.size(); begin += chunk_size)
+        {
+            const size_t end = std::min(begin + chunk_size, todo.size());
+            std::thread prefetcher;
+            if (end < todo.size())
+                prefetcher = std::thread([&, end]() { decode_chunk(next, end); });
+
+            std::map<std::pair<long, long>, std::vector<size_t>> batches;
+            for (size_t j = begin; j < end; ++j)
+            {
+                const auto& sample = current[j - begin];
+                if (sample.loaded)
+                    batches[{sample.image.nr(), sample.image.nc()}].push_back(j);
+            }
+            std::vector<std::vector<yolo_rect>> detections(end - begin);
+            for (const auto& [size, indices] : batches)
+            {
+                std::vector<rgb_image> images;
+                for (const auto j : indices)
+                    images.push_back(std::move(current[j - begin].image));
+                auto results = net(images, batch_size, conf_thresh);
+                for (size_t k = 0; k < indices.size(); ++k)
+                    detections[indices[k] - begin] = std::move(results[k]);
+            }
+
+            std::vector<pseudo_labels> labels;
+            for (size_t j = begin; j < end; ++j)
             {
-                if (not overlaps_any_box(image_info.boxes, pseudo, overlaps, classwise_nms))
+                const auto& sample = current[j - begin];
+                if (not sample.loaded)
+                    continue;
+                const auto& image_info = dataset.images[todo[j]];
+                auto& dets = detections[j - begin];
+                postprocess_detections(sample.tform, dets);
+                pseudo_labels item;
+                item.index = todo[j];
+                item.width = sample.width;
+                item.height = sample.height;
+                for (const auto& pseudo : dets)
                 {
-                    image_dataset_metadata::box box(pseudo.rect);
-                    box.label = pseudo.label;
-                    image_info.boxes.push_back(std::move(box));
+                    if (not overlaps_any_box(image_info.boxes, pseudo, overlaps, classwise_nms) and
+                        not overlaps_any_box(item.boxes, pseudo, overlaps, classwise_nms))
+                    {
+                        image_dataset_metadata::box box(pseudo.rect);
+                        box.label = pseudo.label;
+                        item.boxes.push_back(std::move(box));
+                    }
                 }
+                labels.push_back(std::move(item));
             }
-            progress.print_status(i + 1);
+            checkpoint.append(labels);
+            progress.print_status(end);
+            if (prefetcher.joinable())
+                prefetcher.join();
+            std::swap(current, next);
         }
         progress.finish();
+
+        if (num_shards > 1)
+        {
+            std::clog << "shard " << shard << '/' << num_shards << " saved to " << checkpoint_path
+                      << ", merge the shards with --merge " << num_shards << '\n';
+            return EXIT_SUCCESS;
+        }
+        merge_pseudo_labels(dataset, checkpoint.get_labels());
         chdir.revert();
         save_image_dataset_metadata(dataset, dataset_path.replace_extension("-pseudo.xml"));
         return EXIT_SUCCESS;
@@ -330,7 +516,6 @@ try
 
     if (parser.option("images"))
     {
-        rgb_image image, resized;
         std::vector<fs::path> files;
         const fs::path path = parser.option("images").argument();
         if (not output_path.empty())
@@ -349,38 +534,137 @@ try
             }
         }
         std::clog << "# images: " << files.size() << '\n';
+
+        // The images go through three stages: the decoders load and preprocess them, the
+        // inference engine batches them through the network, and the encoders draw and save
+        // the results.  The main thread consumes the results in the original order.
+        struct detect_job
+        {
+            size_t index = 0;
+            rgb_image image;
+            rectangle_transform tform;
+            std::future<std::vector<yolo_rect>> future;
+            std::vector<yolo_rect> detections;
+        };
+        inference_engine engine(net, batch_size, std::chrono::milliseconds(10), win.conf_thresh);
+        dlib::pipe<detect_job> inferring(4 * batch_size);
+        dlib::pipe<detect_job> encoded(4 * batch_size);
+        std::atomic<size_t> next_file{0};
+        std::vector<std::thread> decoders, encoders;
+        for (size_t w = 0; w < num_decoders; ++w)
+        {
+            decoders.emplace_back(
+                [&]()
+                {
+                    for (size_t i = next_file++; i < files.size(); i = next_file++)
+                    {
+                        detect_job job;
+                        job.index = i;
+                        try
+                        {
+                            load_image(job.image, files[i]);
+                            rgb_image resized;
+                            job.tform = preprocess_image(
+                                job.image,
+                                resized,
+                                image_size,
+                                use_letterbox,
+                                stride);
+                            job.future = engine.submit(std::move(resized));
+                        }
+                        catch (const std::exception& e)
+                        {
+                            std::cerr << "ERROR: " << files[i] << ": " << e.what() << std::endl;
+                            job.image.set_size(0, 0);
+                        }
+                        if (not inferring.enqueue(job))
+                            return;
+                    }
+                });
+        }
+        for (size_t w = 0; w < num_encoders; ++w)
+        {
+            encoders.emplace_back(
+                [&]()
+                {
+                    detect_job job;
+                    while (inferring.dequeue(job))
+                    {
+                        // a failed image is still passed on, for the results to stay in order
+                        if (job.future.valid())
+                        {
+                            try
+                            {
+                                job.detections = job.future.get();
+                                postprocess_detections(job.tform, job.detections);
+                                draw_bounding_boxes(job.image, job.detections, options);
+                                if (not output_path.empty())
+                                {
+                                    auto file = output_path / files[job.index];
+                                    file.replace_extension(".webp");
+                                    save_webp(job.image, file, quality);
+                                    job.image.set_size(0, 0);
+                                }
+                            }
+                            catch (const std::exception& e)
+                            {
+                                std::cerr << "ERROR: " << files[job.index] << ": " << e.what()
+                                          << std::endl;
+                                job.detections.clear();
+                                job.image.set_size(0, 0);
+                            }
+                        }
+                        if (not encoded.enqueue(job))
+                            return;
+                    }
+                });
+        }
+
+        std::map<size_t, detect_job> finished;
         console_progress_indicator progress(files.size());
+        const auto t0 = std::chrono::steady_clock::now();
         for (size_t i = 0; i < files.size(); ++i)
         {
-            auto& file = files[i];
-            load_image(image, file);
-            const auto tform = preprocess_image(image, resized, image_size, use_letterbox, stride);
-            const auto t0 = std::chrono::steady_clock::now();
-            auto detections = net(resized, win.conf_thresh);
-            const auto t1 = std::chrono::steady_clock::now();
-            postprocess_detections(tform, detections);
-            draw_bounding_boxes(image, detections, options);
+            detect_job job;
+            while (finished.count(i) == 0)
+            {
+                encoded.dequeue(job);
+                finished[job.index] = std::move(job);
+            }
+            job = std::move(finished.at(i));
+            finished.erase(i);
             if (output_path.empty())
             {
-                std::clog << file << ": " << fms{t1 - t0}.count() << " ms\n";
-                for (const auto& d : detections)
+                if (job.image.size() == 0)
+                    continue;
+                std::clog << files[i] << ":\n";
+                for (const auto& d : job.detections)
                 {
                     std::clog << d.label << " " << d.detection_confidence << ": ";
                     std::clog << center(d.rect) << " " << d.rect.width() << "x" << d.rect.height();
                     std::clog << "\n";
                 }
-                std::clog << "Total number of detections: " << detections.size() << '\n';
-                win.set_title(file.filename());
-                win.set_image(image);
+                std::clog << "Total number of detections: " << job.detections.size() << '\n';
+                win.set_title(files[i].filename());
+                win.set_image(job.image);
                 std::cin.get();
             }
             else
             {
-                save_webp(image, output_path / file.replace_extension(".webp"), quality);
                 progress.print_status(i + 1);
             }
         }
+        const auto t1 = std::chrono::steady_clock::now();
         progress.finish();
+        inferring.disable();
+        encoded.disable();
+        for (auto& decoder : decoders)
+            decoder.join();
+        for (auto& encoder : encoders)
+            encoder.join();
+        const auto t = std::chrono::duration_cast<fseconds>(t1 - t0).count();
+        std::clog << "processed " << files.size() << " images in " << t << " s ("
+                  << files.size() / t << " images/s)\n";
         return EXIT_SUCCESS;
     }
 
@@ -425,36 +709,105 @@ try
             cv::Size(width, height));
     }
 
-    rgb_image image, resized;
-    running_stats_decayed<float> det_fps(100);
-    while (not win.is_closed())
+    // The frames go through three threads: the capturer reads and preprocesses them, the
+    // detector runs the network, and the main thread draws, displays and records them.  Live
+    // sources keep only the latest frame between stages, while files never drop any.
+    struct video_frame
     {
-        cv::Mat cv_cap;
-        if (not vid_src.read(cv_cap))
-            break;
-        const cv_image<bgr_pixel> tmp(cv_cap);
-        if (win.mirror)
-            flip_image_left_right(tmp, image);
-        else
-            assign_image(image, tmp);
+        rgb_image image;
+        resizable_tensor input;
+        rectangle_transform tform;
+        std::vector<yolo_rect> detections;
+        float fps = 0;
+    };
+    const auto input_means = net.get_input_means();
+    const bool live_source = input_path.empty();
+    dlib::pipe<video_frame> captured(live_source ? 1 : 4);
+    dlib::pipe<video_frame> detected(live_source ? 1 : 4);
+    std::atomic<size_t> num_dropped{0};
+    const auto send = [live_source, &num_dropped](dlib::pipe<video_frame>& out, video_frame& frame)
+    {
+        if (not live_source)
+            return out.enqueue(frame);
+        while (not out.enqueue_or_timeout(frame, 0))
+        {
+            if (not out.is_enabled())
+                return false;
+            video_frame stale;
+            if (out.dequeue_or_timeout(stale, 0))
+                ++num_dropped;
+        }
+        return true;
+    };
 
-        const auto t0 = std::chrono::steady_clock::now();
-        const auto tform = preprocess_image(image, resized, image_size, use_letterbox, stride);
-        auto detections = net(resized, win.conf_thresh);
-        postprocess_detections(tform, detections);
-        const auto t1 = std::chrono::steady_clock::now();
-        draw_bounding_boxes(image, detections, options);
-        win.set_image(image);
-        det_fps.add(1.0f / std::chrono::duration_cast<fseconds>(t1 - t0).count());
-        std::clog << "processed image size: " << resized.nc() << 'x' << resized.nr()
-                  << ", fps: " << det_fps.mean() << "              \r" << std::flush;
+    std::thread capturer(
+        [&]()
+        {
+            video_frame frame;
+            cv::Mat cv_cap;
+            while (vid_src.read(cv_cap))
+            {
+                const cv_image<bgr_pixel> tmp(cv_cap);
+                const bool mirror = win.mirror;
+                if (mirror)
+                    flip_image_left_right(tmp, frame.image);
+                else
+                    assign_image(frame.image, tmp);
+                // the network input is computed from the captured frame in a single pass
+                frame.tform = preprocess_image(
+                    tmp,
+                    frame.input,
+                    input_means,
+                    image_size,
+                    use_letterbox,
+                    stride,
+                    mirror);
+                if (not send(captured, frame))
+                    return;
+            }
+            captured.wait_until_empty();
+            captured.disable();
+        });
+
+    std::thread detector(
+        [&]()
+        {
+            video_frame frame;
+            running_stats_decayed<float> det_fps(100);
+            while (captured.dequeue(frame))
+            {
+                const auto t0 = std::chrono::steady_clock::now();
+                frame.detections = std::move(net(frame.input, win.conf_thresh).front());
+                const auto t1 = std::chrono::steady_clock::now();
+                postprocess_detections(frame.tform, frame.detections);
+                det_fps.add(1.0f / std::chrono::duration_cast<fseconds>(t1 - t0).count());
+                frame.fps = det_fps.mean();
+                if (not send(detected, frame))
+                    return;
+            }
+            detected.wait_until_empty();
+            detected.disable();
+        });
+
+    video_frame frame;
+    while (not win.is_closed() and detected.dequeue(frame))
+    {
+        draw_bounding_boxes(frame.image, frame.detections, options);
+        win.set_image(frame.image);
+        std::clog << "processed image size: " << frame.input.nc() << 'x' << frame.input.nr()
+                  << ", fps: " << frame.fps << ", dropped frames: " << num_dropped
+                  << "              \r" << std::flush;
         if (win.recording and not output_path.empty())
         {
             matrix<bgr_pixel> bgr_img(height, width);
-            assign_image(bgr_img, image);
+            assign_image(bgr_img, frame.image);
             vid_snk.write(toMat(bgr_img));
         }
     }
+    captured.disable();
+    detected.disable();
+    capturer.join();
+    detector.join();
     if (not output_path.empty())
         vid_snk.release();
     return EXIT_SUCCESS;
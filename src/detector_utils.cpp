@@ -27,3 +27,225 @@ void postprocess_detections(
     for (auto& d : detections)
         d.rect = tform(d.rect);
 }
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+#if defined(__AVX512F__)
+    constexpr long simd_width = 16;
+
+    template <int byte> inline __m512 get_channel(const __m512i pixels)
+    {
+        return _mm512_cvtepi32_ps(
+            _mm512_and_si512(_mm512_srli_epi32(pixels, 8 * byte), _mm512_set1_epi32(0xff)));
+    }
+
+    template <int byte> inline void blend_channel(
+        const __m512i tl,
+        const __m512i tr,
+        const __m512i bl,
+        const __m512i br,
+        const __m512 fx,
+        const __m512 fy,
+        const float mean,
+        float* out)
+    {
+        const __m512 l = get_channel<byte>(tl);
+        const __m512 b = get_channel<byte>(bl);
+        const __m512 r = get_channel<byte>(tr);
+        const __m512 s = get_channel<byte>(br);
+        const __m512 t = _mm512_add_ps(l, _mm512_mul_ps(fx, _mm512_sub_ps(r, l)));
+        const __m512 u = _mm512_add_ps(b, _mm512_mul_ps(fx, _mm512_sub_ps(s, b)));
+        const __m512 v = _mm512_add_ps(t, _mm512_mul_ps(fy, _mm512_sub_ps(u, t)));
+        _mm512_storeu_ps(
+            out,
+            _mm512_mul_ps(_mm512_sub_ps(v, _mm512_set1_ps(mean)), _mm512_set1_ps(1.f / 256)));
+    }
+
+    inline void resample_simd(
+        const unsigned char* top,
+        const unsigned char* bottom,
+        const int* off0,
+        const int* off1,
+        const float* fx,
+        const float fy,
+        const float* means,
+        float* const* out)
+    {
+        const __m512i i0 = _mm512_loadu_si512(off0);
+        const __m512i i1 = _mm512_loadu_si512(off1);
+        const __m512i tl = _mm512_i32gather_epi32(i0, top, 1);
+        const __m512i tr = _mm512_i32gather_epi32(i1, top, 1);
+        const __m512i bl = _mm512_i32gather_epi32(i0, bottom, 1);
+        const __m512i br = _mm512_i32gather_epi32(i1, bottom, 1);
+        const __m512 vfx = _mm512_loadu_ps(fx);
+        const __m512 vfy = _mm512_set1_ps(fy);
+        blend_channel<0>(tl, tr, bl, br, vfx, vfy, means[0], out[0]);
+        blend_channel<1>(tl, tr, bl, br, vfx, vfy, means[1], out[1]);
+        blend_channel<2>(tl, tr, bl, br, vfx, vfy, means[2], out[2]);
+    }
+#elif defined(__AVX2__)
+    constexpr long simd_width = 8;
+
+    template <int byte> inline __m256 get_channel(const __m256i pixels)
+    {
+        return _mm256_cvtepi32_ps(
+            _mm256_and_si256(_mm256_srli_epi32(pixels, 8 * byte), _mm256_set1_epi32(0xff)));
+    }
+
+    template <int byte> inline void blend_channel(
+        const __m256i tl,
+        const __m256i tr,
+        const __m256i bl,
+        const __m256i br,
+        const __m256 fx,
+        const __m256 fy,
+        const float mean,
+        float* out)
+    {
+        const __m256 l = get_channel<byte>(tl);
+        const __m256 b = get_channel<byte>(bl);
+        const __m256 r = get_channel<byte>(tr);
+        const __m256 s = get_channel<byte>(br);
+        const __m256 t = _mm256_add_ps(l, _mm256_mul_ps(fx, _mm256_sub_ps(r, l)));
+        const __m256 u = _mm256_add_ps(b, _mm256_mul_ps(fx, _mm256_sub_ps(s, b)));
+        const __m256 v = _mm256_add_ps(t, _mm256_mul_ps(fy, _mm256_sub_ps(u, t)));
+        _mm256_storeu_ps(
+            out,
+            _mm256_mul_ps(_mm256_sub_ps(v, _mm256_set1_ps(mean)), _mm256_set1_ps(1.f / 256)));
+    }
+
+    inline void resample_simd(
+        const unsigned char* top,
+        const unsigned char* bottom,
+        const int* off0,
+        const int* off1,
+        const float* fx,
+        const float fy,
+        const float* means,
+        float* const* out)
+    {
+        const __m256i i0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(off0));
+        const __m256i i1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(off1));
+        const auto t = reinterpret_cast<const int*>(top);
+        const auto b = reinterpret_cast<const int*>(bottom);
+        const __m256i tl = _mm256_i32gather_epi32(t, i0, 1);
+        const __m256i tr = _mm256_i32gather_epi32(t, i1, 1);
+        const __m256i bl = _mm256_i32gather_epi32(b, i0, 1);
+        const __m256i br = _mm256_i32gather_epi32(b, i1, 1);
+        const __m256 vfx = _mm256_loadu_ps(fx);
+        const __m256 vfy = _mm256_set1_ps(fy);
+        blend_channel<0>(tl, tr, bl, br, vfx, vfy, means[0], out[0]);
+        blend_channel<1>(tl, tr, bl, br, vfx, vfy, means[1], out[1]);
+        blend_channel<2>(tl, tr, bl, br, vfx, vfy, means[2], out[2]);
+    }
+#endif
+}  // namespace
+
+void resize_normalize(
+    const unsigned char* data,
+    const long width_step,
+    const long src_nr,
+    const long src_nc,
+    const bool bgr,
+    const bool mirror,
+    const std::array<float, 3>& means,
+    float* output,
+    const long out_nr,
+    const long out_nc,
+    const long top,
+    const long left,
+    const long nr,
+    const long nc)
+{
+    // planes and means in the order of the bytes in the source pixels
+    const long plane = out_nr * out_nc;
+    float* const planes[3]{
+        output + (bgr ? 2 : 0) * plane,
+        output + plane,
+        output + (bgr ? 0 : 2) * plane};
+    const float byte_means[3]{bgr ? means[2] : means[0], means[1], bgr ? means[0] : means[2]};
+    const float pads[3]{-byte_means[0] / 256, -byte_means[1] / 256, -byte_means[2] / 256};
+
+    // Same sampling grid as dlib::resize_image with bilinear interpolation.  The vectorized
+    // code gathers 4 bytes per pixel, so it is only used on columns that do not sample the last
+    // pixel of the row, which could read past the end of the image.
+    const double x_scale = (src_nc - 1) / static_cast<double>(std::max<long>(nc - 1, 1));
+    const double y_scale = (src_nr - 1) / static_cast<double>(std::max<long>(nr - 1, 1));
+    std::vector<int> off0(nc), off1(nc);
+    std::vector<float> fx(nc);
+    long safe_begin = nc;
+    [[maybe_unused]] long safe_end = nc;
+    for (long c = 0; c < nc; ++c)
+    {
+        const double x = c * x_scale;
+        const long x0 = std::min<long>(std::floor(x), src_nc - 1);
+        const long x1 = std::min<long>(x0 + 1, src_nc - 1);
+        fx[c] = x - x0;
+        off0[c] = 3 * (mirror ? src_nc - 1 - x0 : x0);
+        off1[c] = 3 * (mirror ? src_nc - 1 - x1 : x1);
+        if (std::max(off0[c], off1[c]) < 3 * (src_nc - 1))
+        {
+            if (safe_begin == nc)
+                safe_begin = c;
+            safe_end = c + 1;
+        }
+    }
+
+    const auto resample = [&](const unsigned char* t,
+                              const unsigned char* b,
+                              const float fy,
+                              float* const* out,
+                              const long c)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            const float tl = t[off0[c] + k];
+            const float bl = b[off0[c] + k];
+            const float u = tl + fx[c] * (t[off1[c] + k] - tl);
+            const float v = bl + fx[c] * (b[off1[c] + k] - bl);
+            out[k][c] = (u + fy * (v - u) - byte_means[k]) / 256;
+        }
+    };
+
+    for (long r = 0; r < out_nr; ++r)
+    {
+        float* const row[3]{
+            planes[0] + r * out_nc,
+            planes[1] + r * out_nc,
+            planes[2] + r * out_nc};
+        if (r < top or r >= top + nr)
+        {
+            for (int k = 0; k < 3; ++k)
+                std::fill(row[k], row[k] + out_nc, pads[k]);
+            continue;
+        }
+        for (int k = 0; k < 3; ++k)
+        {
+            std::fill(row[k], row[k] + left, pads[k]);
+            std::fill(row[k] + left + nc, row[k] + out_nc, pads[k]);
+        }
+        const double y = (r - top) * y_scale;
+        const long y0 = std::min<long>(std::floor(y), src_nr - 1);
+        const long y1 = std::min<long>(y0 + 1, src_nr - 1);
+        const float fy = y - y0;
+        const unsigned char* t = data + y0 * width_step;
+        const unsigned char* b = data + y1 * width_step;
+        float* const out[3]{row[0] + left, row[1] + left, row[2] + left};
+        long c = 0;
+        for (; c < safe_begin; ++c)
+            resample(t, b, fy, out, c);
+#if defined(__AVX2__) || defined(__AVX512F__)
+        for (; c + simd_width <= safe_end; c += simd_width)
+        {
+            float* const dst[3]{out[0] + c, out[1] + c, out[2] + c};
+            resample_simd(t, b, &off0[c], &off1[c], &fx[c], fy, byte_means, dst);
+        }
+#endif
+        for (; c < nc; ++c)
+            resample(t, b, fy, out, c);
+    }
+}
@@ -37,6 +37,87 @@ dlib::rectangle_transform preprocess_image(
     const long stride = 32
 );
 
+// Bilinear resampling of an interleaved 8-bit RGB or BGR image into the planar channels of a
+// float tensor, normalized like dlib::input_rgb_image.  The resampled image is written to the
+// nr x nc region at (top, left) of the out_nr x out_nc planes, and the rest is padded with
+// black.  It uses AVX-512 or AVX2 when the build enables them, and scalar code otherwise.
+void resize_normalize(
+    const unsigned char* data,
+    const long width_step,
+    const long src_nr,
+    const long src_nc,
+    const bool bgr,
+    const bool mirror,
+    const std::array<float, 3>& means,
+    float* output,
+    const long out_nr,
+    const long out_nc,
+    const long top,
+    const long left,
+    const long nr,
+    const long nc);
+
+// Letterboxes or resizes the image, optionally mirrored, straight into a network input tensor
+// in a single pass, so that no intermediate images are needed.  The image can be any RGB or
+// BGR image, such as the frames from OpenCV, and the means are the ones of the network input
+// layer (see model::get_input_means).
+template <typename image_type>
+dlib::rectangle_transform preprocess_image(
+    const image_type& image,
+    dlib::resizable_tensor& output,
+    const std::array<float, 3>& means,
+    const long image_size,
+    const bool use_letterbox = true,
+    const long stride = 32,
+    const bool mirror = false)
+{
+    using pixel_type = typename dlib::image_traits<image_type>::pixel_type;
+    constexpr bool is_bgr = std::is_same_v<pixel_type, dlib::bgr_pixel>;
+    static_assert(
+        std::is_same_v<pixel_type, dlib::rgb_pixel> or is_bgr,
+        "only rgb_pixel and bgr_pixel images are supported");
+    const double width = dlib::num_columns(image);
+    const double height = dlib::num_rows(image);
+    long nr, nc, top = 0, left = 0;
+    dlib::rectangle_transform tform;
+    if (use_letterbox)
+    {
+        const double scale = image_size / std::max(width, height);
+        nr = std::round(scale * height);
+        nc = std::round(scale * width);
+        top = (image_size - nr) / 2;
+        left = (image_size - nc) / 2;
+        output.set_size(1, 3, image_size, image_size);
+        tform = dlib::rectangle_transform(inv(dlib::point_transform_affine(
+            dlib::identity_matrix<double>(2) * scale,
+            dlib::dpoint(left, top))));
+    }
+    else
+    {
+        const auto scale = image_size / std::max<double>(height, width);
+        nr = lround(height * scale / stride) * stride;
+        nc = lround(width * scale / stride) * stride;
+        output.set_size(1, 3, nr, nc);
+        tform = dlib::point_transform_affine({width / nc, 0, 0, height / nr}, {0, 0});
+    }
+    resize_normalize(
+        static_cast<const unsigned char*>(dlib::image_data(image)),
+        dlib::width_step(image),
+        dlib::num_rows(image),
+        dlib::num_columns(image),
+        is_bgr,
+        mirror,
+        means,
+        output.host(),
+        output.nr(),
+        output.nc(),
+        top,
+        left,
+        nr,
+        nc);
+    return tform;
+}
+
 void postprocess_detections(
     const dlib::rectangle_transform& tform,
     std::vector<dlib::yolo_rect>& detections);
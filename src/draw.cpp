@@ -16,12 +16,8 @@ auto drawing_options::operator=(const drawing_options& item) -> drawing_options&
     return *this;
 }
 
-auto drawing_options::get_font() -> const std::shared_ptr<dlib::font>&
+auto drawing_options::get_font() const -> const std::shared_ptr<dlib::font>&
 {
-    if (custom_font != nullptr)
-        font = custom_font;
-    else
-        font = default_font;
     return font;
 }
 
@@ -37,6 +33,7 @@ auto drawing_options::set_font(const std::string& font_path) -> void
             font->read_bdf_file(fin, 0xFFFF);
             font->adjust_metrics();
             custom_font = std::move(font);
+            this->font = custom_font;
         }
         else
         {
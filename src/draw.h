@@ -18,13 +18,13 @@ struct drawing_options
     std::map<std::string, std::string> mapping;
 
     auto operator=(const drawing_options& item) -> drawing_options&;
-    auto get_font() -> const std::shared_ptr<dlib::font>&;
+    auto get_font() const -> const std::shared_ptr<dlib::font>&;
     auto set_font(const std::string& font_path) -> void;
 
     private:
     const std::shared_ptr<dlib::font> default_font = dlib::default_font::get_font();
     std::shared_ptr<dlib::bdf_font> custom_font;
-    std::shared_ptr<dlib::font> font;
+    std::shared_ptr<dlib::font> font = default_font;
     std::string font_path{};
 
     friend void serialize(const drawing_options& item, std::ostream& out);
@@ -0,0 +1,105 @@
+#include "epoch_sampler.h"
+
+#include <algorithm>
+#include <dlib/rand.h>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+epoch_sampler::epoch_sampler(
+    const size_t num_items,
+    const unsigned long seed,
+    const size_t block_size)
+    : num_items(num_items),
+      seed(seed),
+      block_size(std::max<size_t>(block_size, 1)),
+      blocks_per_epoch(std::max<size_t>((num_items + this->block_size - 1) / this->block_size, 1))
+{
+    if (num_items == 0)
+        throw std::invalid_argument("ERROR: the sampler needs at least one item");
+}
+
+void epoch_sampler::set_weights(const std::vector<double>& weights)
+{
+    if (weights.size() != num_items)
+        throw std::invalid_argument("ERROR: the sampler needs one weight per item");
+    std::vector<double> cumulative(num_items);
+    std::partial_sum(weights.begin(), weights.end(), cumulative.begin());
+    if (not(cumulative.back() > 0))
+        throw std::invalid_argument("ERROR: the sampling weights must have a positive sum");
+    const std::lock_guard<std::mutex> lock(mutex);
+    cumulative_weights = std::move(cumulative);
+    std::atomic_store(&current, std::shared_ptr<const epoch_order>());
+}
+
+auto epoch_sampler::make_epoch(const size_t epoch) const -> std::shared_ptr<const epoch_order>
+{
+    dlib::rand rnd;
+    rnd.set_seed(std::to_string(seed) + ":" + std::to_string(epoch));
+    const auto random_below = [&rnd](const size_t n) -> size_t
+    { return rnd.get_random_64bit_number() % n; };
+
+    auto order = std::make_shared<epoch_order>();
+    order->epoch = epoch;
+    auto& items = order->items;
+    items.resize(num_items);
+    if (cumulative_weights.empty())
+    {
+        std::iota(items.begin(), items.end(), 0);
+    }
+    else
+    {
+        const auto total = cumulative_weights.back();
+        for (auto& item : items)
+        {
+            const auto it = std::upper_bound(
+                cumulative_weights.begin(),
+                cumulative_weights.end(),
+                rnd.get_random_double() * total);
+            item = std::min<size_t>(it - cumulative_weights.begin(), num_items - 1);
+        }
+        std::sort(items.begin(), items.end());
+    }
+
+    // shuffle the items within each block, then the blocks
+    for (size_t begin = 0; begin < num_items; begin += block_size)
+    {
+        const auto end = std::min(begin + block_size, num_items);
+        for (size_t i = end - 1; i > begin; --i)
+            std::swap(items[i], items[begin + random_below(i - begin + 1)]);
+    }
+    auto& blocks = order->blocks;
+    blocks.resize(blocks_per_epoch);
+    for (size_t b = 0; b < blocks_per_epoch; ++b)
+        blocks[b] = b * block_size;
+    for (size_t i = blocks_per_epoch - 1; i > 0; --i)
+        std::swap(blocks[i], blocks[random_below(i + 1)]);
+    return order;
+}
+
+auto epoch_sampler::get_epoch_order(const size_t epoch) -> std::shared_ptr<const epoch_order>
+{
+    // within an epoch, the order is shared without locking
+    auto order = std::atomic_load(&current);
+    if (order and order->epoch == epoch)
+        return order;
+    const std::lock_guard<std::mutex> lock(mutex);
+    // another loader may have made the epoch in the meantime
+    const auto latest = std::atomic_load(&current);
+    if (latest and latest->epoch == epoch)
+        return latest;
+    // a slow loader may still be finishing the previous epoch, it gets its own copy
+    order = make_epoch(epoch);
+    if (not latest or latest->epoch < epoch)
+        std::atomic_store(&current, order);
+    return order;
+}
+
+void epoch_sampler::get_block(std::vector<size_t>& block)
+{
+    const auto b = next_block++;
+    const auto order = get_epoch_order(b / blocks_per_epoch);
+    const auto begin = order->blocks[b % blocks_per_epoch];
+    const auto end = std::min(begin + block_size, num_items);
+    block.assign(order->items.begin() + begin, order->items.begin() + end);
+}
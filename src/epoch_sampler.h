@@ -0,0 +1,57 @@
+#ifndef epoch_sampler_h_INCLUDED
+#define epoch_sampler_h_INCLUDED
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Hands out the indices of a dataset to the data loaders, epoch after epoch.  Each epoch visits
+// every item once, or a class-balanced draw of items if weights are given.  The items of an
+// epoch are sorted and cut into blocks of consecutive indices, which are shuffled, as well as
+// the items within each block: the order is random, but a loader reads a block of neighboring
+// items, which is friendly to the page cache and the image cache.
+//
+// The loaders take the blocks in turn through an atomic cursor, and the order of each epoch
+// only depends on the seed, so the sequence of blocks is reproducible.  Which loader gets which
+// block still depends on the timing of the threads.
+class epoch_sampler
+{
+    public:
+    epoch_sampler() = delete;
+    epoch_sampler(const size_t num_items, const unsigned long seed, const size_t block_size = 64);
+
+    // Sampling weights of the items, not necessarily normalized.  The items of each epoch are
+    // then drawn with replacement, proportionally to their weight.
+    void set_weights(const std::vector<double>& weights);
+
+    // Replaces the content of block with the indices of the next block
+    void get_block(std::vector<size_t>& block);
+
+    size_t get_epoch() const { return next_block / blocks_per_epoch; }
+
+    private:
+    struct epoch_order
+    {
+        size_t epoch;
+        std::vector<size_t> items;
+        // the position of the first item of each block, shuffled
+        std::vector<size_t> blocks;
+    };
+
+    auto make_epoch(const size_t epoch) const -> std::shared_ptr<const epoch_order>;
+    auto get_epoch_order(const size_t epoch) -> std::shared_ptr<const epoch_order>;
+
+    size_t num_items;
+    unsigned long seed;
+    size_t block_size;
+    size_t blocks_per_epoch;
+    std::vector<double> cumulative_weights;
+    std::atomic<size_t> next_block{0};
+    // only taken when a loader moves to another epoch
+    std::mutex mutex;
+    // read and replaced with the atomic functions of std::shared_ptr
+    std::shared_ptr<const epoch_order> current;
+};
+
+#endif  // epoch_sampler_h_INCLUDED
@@ -1,5 +1,6 @@
 #include "detector_utils.h"
 #include "draw.h"
+#include "inference_engine.h"
 #include "model.h"
 
 #include <dlib/cmd_line_parser.h>
@@ -22,13 +23,19 @@ auto round_decimal_places(const double val, const unsigned int n = 2) -> double
 auto main(const int argc, const char** argv) -> int
 try
 {
+    const auto num_threads = std::thread::hardware_concurrency();
+    const auto num_threads_str = std::to_string(num_threads);
     command_line_parser parser;
+    parser.add_option("arch", "network architecture if not in the file (default: yolov7)", 1);
     parser.add_option("json", "path to the image_info_test-dev2017.json", 1);
     parser.add_option("size", "image size to process images (default: 640)", 1);
     parser.add_option("dnn", "path to the network to evaluate", 1);
     parser.add_option("conf", "detection confidence threshold (default: 0.001)", 1);
     parser.add_option("letterbox", "force letter box on single inference");
+    parser.add_option("nms-grid", "use the grid NMS, faster on crowded scenes");
     parser.add_option("draw", "draw bounding boxes on images");
+    parser.add_option("batch", "batch size for inference (default: 8)", 1);
+    parser.add_option("workers", "number of image decoders (default: " + num_threads_str + ")", 1);
 
     parser.set_group_name("Help Options");
     parser.add_option("h", "alias for --help");
@@ -47,6 +54,8 @@ try
     const double conf_thresh = get_option(parser, "conf", 0.001);
     const bool use_letterbox = parser.option("letterbox");
     const bool draw = parser.option("draw");
+    const size_t batch_size = get_option(parser, "batch", 8);
+    const size_t num_workers = get_option(parser, "workers", num_threads);
     const fs::path json_path = get_option(parser, "json", "");
     if (json_path.empty())
     {
@@ -77,8 +86,17 @@ try
     }
 
     // load the network in inference mode
-    model net;
+    model net(get_option(parser, "arch", "yolov7"));
     net.load_infer(dnn_path);
+    if (parser.option("nms-grid"))
+    {
+        const auto& nms = net.get_options().overlaps_nms;
+        net.adjust_nms(
+            nms.get_iou_thresh(),
+            nms.get_percent_covered_thresh(),
+            net.get_options().classwise_nms,
+            nms_algorithm::grid);
+    }
 
     image_window win;
     drawing_options options;
@@ -87,40 +105,75 @@ try
     for (const auto& label : net.get_options().labels)
         options.mapping[label] = label;
 
-    matrix<rgb_pixel> image, resized;
+    matrix<rgb_pixel> image;
     const auto images_path = json_path.parent_path() / "test2017";
+    const auto& images_info = data["images"];
     json results;
-    console_progress_indicator progress(data["images"].size());
-    size_t cnt = 0;
-    for (const auto& image_info : data["images"])
+    console_progress_indicator progress(images_info.size());
+    inference_engine engine(net, batch_size, std::chrono::milliseconds(10), conf_thresh);
+    // The images are decoded in chunks.  The next chunk is decoded and submitted before the
+    // results of the current one are collected, so the engine always has a chunk to run on while
+    // the workers decode, and while the results are collected.
+    const size_t chunk_size = 16 * batch_size;
+    struct pending_image
     {
-        const auto image_id = image_info["id"].get<int>();
-        load_image(image, images_path / image_info["file_name"].get<fs::path>());
-        const auto tform = preprocess_image(image, resized, image_size, use_letterbox);
-        auto dets = net(resized, conf_thresh);
-        postprocess_detections(tform, dets);
-        for (const auto& det : dets)
-        {
-            const double x = round_decimal_places(det.rect.left(), 1);
-            const double y = round_decimal_places(det.rect.top(), 1);
-            const double w = round_decimal_places(det.rect.width(), 1);
-            const double h = round_decimal_places(det.rect.height(), 1);
-            const auto d = json{
-                {"image_id", image_id},
-                {"category_id", categories.at(det.label)},
-                {"bbox", json{x, y, w, h}},
-                {"score", round_decimal_places(det.detection_confidence, 3)}};
-            results.push_back(std::move(d));
-        }
-        progress.print_status(++cnt);
-
-        if (draw)
+        std::future<std::vector<yolo_rect>> detections;
+        rectangle_transform tform;
+    };
+    const auto submit_chunk = [&](const size_t begin, std::vector<pending_image>& chunk)
+    {
+        parallel_for(
+            num_workers,
+            begin,
+            std::min(begin + chunk_size, images_info.size()),
+            [&](const size_t i)
+            {
+                matrix<rgb_pixel> temp, resized;
+                load_image(temp, images_path / images_info[i]["file_name"].get<fs::path>());
+                auto& pending = chunk[i - begin];
+                pending.tform = preprocess_image(temp, resized, image_size, use_letterbox);
+                pending.detections = engine.submit(std::move(resized));
+            });
+    };
+    std::vector<pending_image> current(chunk_size), next(chunk_size);
+    if (not images_info.empty())
+        submit_chunk(0, current);
+    for (size_t begin = 0; begin < images_info.size(); begin += chunk_size)
+    {
+        const size_t end = std::min(begin + chunk_size, images_info.size());
+        if (end < images_info.size())
+            submit_chunk(end, next);
+        for (size_t i = begin; i < end; ++i)
         {
-            draw_bounding_boxes(image, dets, options);
-            win.set_image(image);
-            std::cout << results.back().dump(2) << '\n';
-            std::cin.get();
+            const auto image_id = images_info[i]["id"].get<int>();
+            auto& pending = current[i - begin];
+            auto dets = pending.detections.get();
+            postprocess_detections(pending.tform, dets);
+            for (const auto& det : dets)
+            {
+                const double x = round_decimal_places(det.rect.left(), 1);
+                const double y = round_decimal_places(det.rect.top(), 1);
+                const double w = round_decimal_places(det.rect.width(), 1);
+                const double h = round_decimal_places(det.rect.height(), 1);
+                const auto d = json{
+                    {"image_id", image_id},
+                    {"category_id", categories.at(det.label)},
+                    {"bbox", json{x, y, w, h}},
+                    {"score", round_decimal_places(det.detection_confidence, 3)}};
+                results.push_back(std::move(d));
+            }
+            progress.print_status(i + 1);
+
+            if (draw)
+            {
+                load_image(image, images_path / images_info[i]["file_name"].get<fs::path>());
+                draw_bounding_boxes(image, dets, options);
+                win.set_image(image);
+                std::cout << results.back().dump(2) << '\n';
+                std::cin.get();
+            }
         }
+        std::swap(current, next);
     }
     progress.finish();
     std::clog << "saving results\n";
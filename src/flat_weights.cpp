@@ -0,0 +1,371 @@
+#include "flat_weights.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <dlib/serialize.h>
+#include <fcntl.h>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace
+{
+    constexpr char signature[8] = {'y', 'o', 'l', 'o', 'f', 'l', 'a', 't'};
+    constexpr uint32_t format_version = 1;
+    constexpr uint64_t alignment = 64;
+
+    struct header
+    {
+        char signature[8];
+        uint32_t version;
+        uint32_t alignment;
+        uint64_t skeleton_offset;
+        uint64_t skeleton_size;
+        uint64_t table_offset;
+        uint64_t table_size;  // number of arrays
+        uint64_t arrays_offset;
+        uint64_t arrays_size;
+    };
+
+    auto align(const uint64_t offset) -> uint64_t
+    {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    // The header of the shared memory segments, which lives in the mappings.  In "<name>", only
+    // the version is used, and it is 0 until a first publication.  In "<name>.<version>", the
+    // content follows the header, and ready is set once it is written.
+    constexpr char shared_signature[8] = {'y', 'o', 'l', 'o', 's', 'h', 'm', '\0'};
+    struct shared_header
+    {
+        char signature[8];
+        std::atomic<uint64_t> version;
+        std::atomic<uint64_t> ready;
+        uint64_t size;
+    };
+    static_assert(std::atomic<uint64_t>::is_always_lock_free);
+    static_assert(sizeof(shared_header) <= alignment);
+    // the content starts aligned, as the mappings are
+    constexpr size_t shared_content_offset = alignment;
+
+    auto get_segment_name(const std::string& name, const uint64_t version) -> std::string
+    {
+        return name + "." + std::to_string(version);
+    }
+
+    // Maps a whole shared memory segment, or returns nullptr if it does not exist.  A segment
+    // still being created, without its size or signature yet, is reported as missing.
+    auto map_segment(const std::string& name, const bool writable, size_t& size) -> void*
+    {
+        const int fd = shm_open(name.c_str(), writable ? O_RDWR : O_RDONLY, 0);
+        if (fd < 0)
+        {
+            if (errno == ENOENT)
+                return nullptr;
+            throw dlib::serialization_error(
+                "ERROR: unable to open the shared memory " + name + ": " + std::strerror(errno));
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            close(fd);
+            throw dlib::serialization_error("ERROR: unable to get the size of " + name);
+        }
+        if (static_cast<size_t>(st.st_size) < shared_content_offset)
+        {
+            close(fd);
+            return nullptr;
+        }
+        size = st.st_size;
+        const int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+        void* data = mmap(nullptr, size, protection, MAP_SHARED, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+            throw dlib::serialization_error("ERROR: unable to map " + name + " in memory");
+        const auto h = static_cast<const shared_header*>(data);
+        if (std::memcmp(h->signature, shared_signature, sizeof(shared_signature)) != 0)
+        {
+            const bool is_created = h->signature[0] != '\0';
+            munmap(data, size);
+            if (not is_created)
+                return nullptr;
+            throw dlib::serialization_error("ERROR: " + name + " is not a shared weights segment");
+        }
+        return data;
+    }
+
+    // creates a shared memory segment of the given size, initialized with a header
+    auto create_segment(const std::string& name, const size_t size) -> shared_header*
+    {
+        // a segment left by a publisher that died is replaced
+        shm_unlink(name.c_str());
+        const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0)
+        {
+            throw dlib::serialization_error(
+                "ERROR: unable to create the shared memory " + name + ": " + std::strerror(errno));
+        }
+        void* data = MAP_FAILED;
+        if (ftruncate(fd, size) == 0)
+            data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+        {
+            shm_unlink(name.c_str());
+            throw dlib::serialization_error("ERROR: unable to allocate the shared memory " + name);
+        }
+        // the new pages are filled with zeros
+        auto h = new (data) shared_header{};
+        std::memcpy(h->signature, shared_signature, sizeof(shared_signature));
+        return h;
+    }
+}  // namespace
+
+void flat_weights_writer::add(
+    const void* data,
+    const size_t size,
+    const std::array<int64_t, 4>& shape)
+{
+    flat_array array;
+    array.offset = align(arrays.size());
+    array.size = size;
+    array.shape = shape;
+    arrays.resize(array.offset + size);
+    if (size > 0)
+        std::memcpy(arrays.data() + array.offset, data, size);
+    table.push_back(array);
+}
+
+void flat_weights_writer::write(std::ostream& out, const std::string& skeleton) const
+{
+    header h{};
+    std::memcpy(h.signature, signature, sizeof(signature));
+    h.version = format_version;
+    h.alignment = alignment;
+    h.skeleton_offset = sizeof(header);
+    h.skeleton_size = skeleton.size();
+    h.table_offset = align(h.skeleton_offset + h.skeleton_size);
+    h.table_size = table.size();
+    h.arrays_offset = align(h.table_offset + table.size() * sizeof(flat_array));
+    h.arrays_size = arrays.size();
+
+    const std::string padding(alignment, '\0');
+    const uint64_t table_end = h.table_offset + table.size() * sizeof(flat_array);
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    out.write(skeleton.data(), skeleton.size());
+    out.write(padding.data(), h.table_offset - (h.skeleton_offset + h.skeleton_size));
+    out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(flat_array));
+    out.write(padding.data(), h.arrays_offset - table_end);
+    out.write(arrays.data(), arrays.size());
+}
+
+void flat_weights_writer::save(const std::string& path, const std::string& skeleton) const
+{
+    std::ofstream fout(path, std::ios::binary);
+    if (not fout.good())
+        throw dlib::serialization_error("Unable to open " + path + " for writing.");
+    write(fout, skeleton);
+    if (not fout.good())
+        throw dlib::serialization_error("Error writing " + path);
+}
+
+auto flat_weights_writer::publish(const std::string& name, const std::string& skeleton) const
+    -> uint64_t
+{
+    std::ostringstream sout;
+    write(sout, skeleton);
+    const std::string content = sout.str();
+
+    // the segment holding the current version is created by the first publication
+    size_t current_size = 0;
+    auto current = static_cast<shared_header*>(map_segment(name, true, current_size));
+    if (current == nullptr)
+    {
+        current = create_segment(name, shared_content_offset);
+        current_size = shared_content_offset;
+    }
+    const uint64_t previous = current->version.load(std::memory_order_acquire);
+    const uint64_t version = previous + 1;
+
+    const std::string segment_name = get_segment_name(name, version);
+    const size_t size = shared_content_offset + content.size();
+    shared_header* segment = nullptr;
+    try
+    {
+        segment = create_segment(segment_name, size);
+    }
+    catch (...)
+    {
+        munmap(current, current_size);
+        throw;
+    }
+    segment->version.store(version, std::memory_order_relaxed);
+    segment->size = content.size();
+    char* data = reinterpret_cast<char*>(segment) + shared_content_offset;
+    std::memcpy(data, content.data(), content.size());
+    segment->ready.store(1, std::memory_order_release);
+    munmap(segment, size);
+
+    // the new version becomes the current one, and the processes still attached to the previous
+    // one keep their mappings of its unlinked segment
+    current->version.store(version, std::memory_order_release);
+    munmap(current, current_size);
+    if (previous > 0)
+        shm_unlink(get_segment_name(name, previous).c_str());
+    return version;
+}
+
+auto get_flat_weights_version(const std::string& name) -> uint64_t
+{
+    size_t size = 0;
+    const auto current = static_cast<const shared_header*>(map_segment(name, false, size));
+    if (current == nullptr)
+        return 0;
+    const uint64_t version = current->version.load(std::memory_order_acquire);
+    munmap(const_cast<shared_header*>(current), size);
+    return version;
+}
+
+void unpublish_flat_weights(const std::string& name)
+{
+    const uint64_t version = get_flat_weights_version(name);
+    shm_unlink(name.c_str());
+    if (version > 0)
+        shm_unlink(get_segment_name(name, version).c_str());
+}
+
+flat_weights::flat_weights(const std::string& path)
+{
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw dlib::serialization_error("Unable to open " + path + " for reading.");
+    struct stat st;
+    if (fstat(fd, &st) != 0 or static_cast<size_t>(st.st_size) < sizeof(header))
+    {
+        close(fd);
+        throw dlib::serialization_error("ERROR: " + path + " is not a flat weights file");
+    }
+    mapping_size = st.st_size;
+    // the mapping stays valid after the file is closed
+    void* data = mmap(nullptr, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        throw dlib::serialization_error("ERROR: unable to map " + path + " in memory");
+    mapping = static_cast<const char*>(data);
+    try
+    {
+        parse(0, path);
+    }
+    catch (...)
+    {
+        munmap(const_cast<char*>(mapping), mapping_size);
+        throw;
+    }
+}
+
+auto flat_weights::attach(const std::string& name, const uint64_t version)
+    -> std::shared_ptr<const flat_weights>
+{
+    // a publication in progress is waited for, and a current version replaced while attaching
+    // is read again
+    constexpr int max_attempts = 100;
+    for (int attempt = 1;; ++attempt)
+    {
+        const uint64_t v = version > 0 ? version : get_flat_weights_version(name);
+        size_t size = 0;
+        void* data = nullptr;
+        if (v > 0)
+            data = map_segment(get_segment_name(name, v), false, size);
+        const auto h = static_cast<const shared_header*>(data);
+        if (h and h->ready.load(std::memory_order_acquire) != 0)
+        {
+            std::shared_ptr<flat_weights> weights(new flat_weights());
+            weights->mapping = static_cast<const char*>(data);
+            weights->mapping_size = size;
+            weights->version = v;
+            if (h->version.load(std::memory_order_relaxed) != v or
+                h->size > size - shared_content_offset)
+            {
+                throw dlib::serialization_error(
+                    "ERROR: " + get_segment_name(name, v) + " is not a valid shared segment");
+            }
+            weights->parse(shared_content_offset, name);
+            return weights;
+        }
+        if (data)
+            munmap(data, size);
+        if (attempt == max_attempts)
+        {
+            if (version > 0)
+            {
+                throw dlib::serialization_error(
+                    "ERROR: the version " + std::to_string(version) + " of " + name +
+                    " is not published");
+            }
+            throw dlib::serialization_error("ERROR: no weights are published as " + name);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+flat_weights::~flat_weights()
+{
+    if (mapping)
+        munmap(const_cast<char*>(mapping), mapping_size);
+}
+
+void flat_weights::parse(const size_t offset, const std::string& source)
+{
+    const char* content = mapping + offset;
+    const uint64_t content_size = mapping_size - offset;
+    header h;
+    if (content_size < sizeof(h))
+        throw dlib::serialization_error("ERROR: " + source + " is not a flat weights file");
+    std::memcpy(&h, content, sizeof(h));
+    const auto is_inside = [content_size](const uint64_t begin, const uint64_t size)
+    { return begin <= content_size and size <= content_size - begin; };
+    if (std::memcmp(h.signature, signature, sizeof(signature)) != 0 or
+        h.version != format_version or h.alignment != alignment or
+        not is_inside(h.skeleton_offset, h.skeleton_size) or
+        h.table_size > content_size / sizeof(flat_array) or
+        not is_inside(h.table_offset, h.table_size * sizeof(flat_array)) or
+        not is_inside(h.arrays_offset, h.arrays_size))
+    {
+        throw dlib::serialization_error("ERROR: " + source + " is not a valid flat weights file");
+    }
+    skeleton = content + h.skeleton_offset;
+    skeleton_size = h.skeleton_size;
+    arrays = content + h.arrays_offset;
+    arrays_size = h.arrays_size;
+    table.resize(h.table_size);
+    std::memcpy(table.data(), content + h.table_offset, h.table_size * sizeof(flat_array));
+    for (const auto& array : table)
+    {
+        if (array.offset > arrays_size or array.size > arrays_size - array.offset)
+            throw dlib::serialization_error("ERROR: " + source + " has an array out of bounds");
+    }
+}
+
+auto flat_weights::is_flat_weights(const std::string& path) -> bool
+{
+    std::ifstream fin(path, std::ios::binary);
+    char buffer[sizeof(signature)];
+    return fin.read(buffer, sizeof(buffer)) and
+           std::memcmp(buffer, signature, sizeof(signature)) == 0;
+}
+
+auto flat_weights::get_skeleton() const -> std::string
+{
+    return std::string(skeleton, skeleton_size);
+}
+
+auto flat_weights::get_data(const flat_array& array) const -> const void*
+{
+    return arrays + array.offset;
+}
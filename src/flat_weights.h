@@ -0,0 +1,96 @@
+#ifndef flat_weights_h_INCLUDED
+#define flat_weights_h_INCLUDED
+
+#include <array>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A network file that can be mapped in memory.  It holds a skeleton, the network serialized by
+// dlib without its parameters, and the parameters as raw arrays aligned to 64 bytes, in the
+// order the layers are visited.  Loading it only parses the small skeleton: the parameters are
+// copied with memcpy, or used in place from the mapped pages, which the processes loading the
+// same file then share.
+//
+// The layout is a fixed header, the skeleton, the table of arrays, then the arrays.  The numbers
+// are in the byte order of the host.
+//
+// The same content can also be published in POSIX shared memory, for the processes of a host to
+// map a single copy of the weights read-only.  Each publication under a name gets the next
+// version, in its own segment: "<name>.<version>" holds the content after a small header, and
+// "<name>" holds the version currently published.  Republishing creates a new segment, then
+// switches the current version and unlinks the previous segment, which the processes still
+// attached to it keep until they detach.  A name has a single publisher at a time.
+
+// Where an array of parameters is, and the shape of the tensor it comes from, if any
+struct flat_array
+{
+    uint64_t offset = 0;  // from the start of the arrays
+    uint64_t size = 0;    // in bytes
+    std::array<int64_t, 4> shape{};
+};
+
+// Collects the arrays of a network, then writes the file
+class flat_weights_writer
+{
+    public:
+    void add(const void* data, const size_t size, const std::array<int64_t, 4>& shape = {});
+    void write(std::ostream& out, const std::string& skeleton) const;
+    void save(const std::string& path, const std::string& skeleton) const;
+    // publishes the content under a name, which starts with a slash, and returns its version
+    auto publish(const std::string& name, const std::string& skeleton) const -> uint64_t;
+
+    private:
+    std::vector<flat_array> table;
+    std::string arrays;
+};
+
+// The version of the weights currently published under a name, or 0 if there are none
+auto get_flat_weights_version(const std::string& name) -> uint64_t;
+
+// Removes the weights published under a name, the processes attached keep their mappings
+void unpublish_flat_weights(const std::string& name);
+
+// A file written by flat_weights_writer, or weights it published in shared memory, mapped
+// read-only in memory
+class flat_weights
+{
+    public:
+    explicit flat_weights(const std::string& path);
+
+    // Attaches to the weights published under a name, in their current version if it is 0.
+    // Weights still being published are waited for a little.
+    static auto attach(const std::string& name, const uint64_t version = 0)
+        -> std::shared_ptr<const flat_weights>;
+
+    ~flat_weights();
+    flat_weights(const flat_weights&) = delete;
+    flat_weights& operator=(const flat_weights&) = delete;
+
+    // checks the signature at the start of a file
+    static auto is_flat_weights(const std::string& path) -> bool;
+
+    auto get_skeleton() const -> std::string;
+    auto get_table() const -> const std::vector<flat_array>& { return table; }
+    auto get_data(const flat_array& array) const -> const void*;
+    // the version of the shared weights, 0 for a file
+    auto get_version() const -> uint64_t { return version; }
+
+    private:
+    flat_weights() = default;
+    // parses the content at the offset of the mapping, which must be set
+    void parse(const size_t offset, const std::string& source);
+
+    uint64_t version = 0;
+    const char* mapping = nullptr;
+    size_t mapping_size = 0;
+    const char* skeleton = nullptr;
+    size_t skeleton_size = 0;
+    const char* arrays = nullptr;
+    size_t arrays_size = 0;
+    std::vector<flat_array> table;
+};
+
+#endif  // flat_weights_h_INCLUDED
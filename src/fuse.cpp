@@ -12,7 +12,11 @@ auto main(const int argc, const char** argv) -> int
 try
 {
     command_line_parser parser;
+    parser.add_option("arch", "network architecture if not in the file (default: yolov7)", 1);
+    parser.add_option("bf16", "store the weights of the convolutions as bfloat16");
+    parser.add_option("mappable", "write a memory-mappable file, faster to load");
     parser.add_option("output", "path to the fused network (default: fused.dnn)", 1);
+    parser.add_option("publish", "also publish the network in shared memory as <arg>", 1);
     parser.add_option("details", "print the network details");
     parser.set_group_name("Help Options");
     parser.add_option("h", "alias for --help");
@@ -28,7 +32,7 @@ try
 
     const fs::path output_path = get_option(parser, "output", "fused.dnn");
 
-    model net;
+    model net(get_option(parser, "arch", "yolov7"));
     std::clog << "loading network from " << net_path;
     auto t0 = std::chrono::steady_clock::now();
     if (net_path.extension() == ".dnn")
@@ -55,11 +59,29 @@ try
     net.fuse();
     t1 = std::chrono::steady_clock::now();
     std::clog << " (" << std::chrono::duration_cast<fms>(t1 - t0).count() << " ms)\n";
+    if (parser.option("bf16"))
+    {
+        std::clog << "converting the weights to bfloat16";
+        t0 = std::chrono::steady_clock::now();
+        net.quantize(inference_precision::bf16);
+        t1 = std::chrono::steady_clock::now();
+        std::clog << " (" << std::chrono::duration_cast<fms>(t1 - t0).count() << " ms)\n";
+    }
     std::clog << "saving network to " << output_path;
     t0 = std::chrono::steady_clock::now();
-    net.save_infer(output_path);
+    net.save_infer(output_path, parser.option("mappable"));
     t1 = std::chrono::steady_clock::now();
     std::clog << " (" << std::chrono::duration_cast<fms>(t1 - t0).count() << " ms)\n";
+    if (parser.option("publish"))
+    {
+        const std::string name = parser.option("publish").argument();
+        std::clog << "publishing network as " << name;
+        t0 = std::chrono::steady_clock::now();
+        const auto version = net.save_shared(name);
+        t1 = std::chrono::steady_clock::now();
+        std::clog << ", version " << version << " ("
+                  << std::chrono::duration_cast<fms>(t1 - t0).count() << " ms)\n";
+    }
 
     return EXIT_SUCCESS;
 }
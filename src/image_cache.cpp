@@ -0,0 +1,64 @@
+#include "image_cache.h"
+
+namespace
+{
+    auto get_image_bytes(const cached_image& item) -> size_t
+    {
+        return sizeof(cached_image) + item.image.size() * sizeof(dlib::rgb_pixel);
+    }
+}  // namespace
+
+image_cache::image_cache(const size_t max_bytes, const size_t num_shards)
+    : max_bytes(max_bytes),
+      max_shard_bytes(max_bytes / std::max<size_t>(num_shards, 1)),
+      shards(std::max<size_t>(num_shards, 1))
+{
+}
+
+auto image_cache::get(const size_t index) -> std::shared_ptr<const cached_image>
+{
+    auto& s = get_shard(index);
+    const std::lock_guard<std::mutex> lock(s.mutex);
+    const auto it = s.entries.find(index);
+    if (it == s.entries.end())
+    {
+        ++misses;
+        return nullptr;
+    }
+    ++hits;
+    s.lru.splice(s.lru.begin(), s.lru, it->second.position);
+    return it->second.image;
+}
+
+void image_cache::put(const size_t index, std::shared_ptr<const cached_image> image)
+{
+    const auto num_bytes = get_image_bytes(*image);
+    if (num_bytes > max_shard_bytes)
+        return;
+    auto& s = get_shard(index);
+    const std::lock_guard<std::mutex> lock(s.mutex);
+    // another loader may have put the same image in the meantime
+    if (s.entries.count(index) != 0)
+        return;
+    while (s.num_bytes + num_bytes > max_shard_bytes)
+    {
+        const auto it = s.entries.find(s.lru.back());
+        s.num_bytes -= get_image_bytes(*it->second.image);
+        s.entries.erase(it);
+        s.lru.pop_back();
+    }
+    s.lru.push_front(index);
+    s.entries.emplace(index, shard::entry{std::move(image), s.lru.begin()});
+    s.num_bytes += num_bytes;
+}
+
+size_t image_cache::get_num_bytes() const
+{
+    size_t num_bytes = 0;
+    for (const auto& s : shards)
+    {
+        const std::lock_guard<std::mutex> lock(s.mutex);
+        num_bytes += s.num_bytes;
+    }
+    return num_bytes;
+}
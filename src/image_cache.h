@@ -0,0 +1,62 @@
+#ifndef image_cache_h_INCLUDED
+#define image_cache_h_INCLUDED
+
+#include <atomic>
+#include <dlib/image_transforms.h>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+// A letterboxed image and the transform from the coordinates of the original one
+struct cached_image
+{
+    dlib::matrix<dlib::rgb_pixel> image;
+    dlib::point_transform_affine tform;
+};
+
+// Thread-safe cache of decoded images, keyed by their index in the dataset, that evicts the
+// least recently used ones to stay within a memory budget.  The keys are spread over several
+// shards, each with its own lock and its own part of the budget, so that the loaders rarely
+// wait for each other.  The images are shared and immutable: a hit costs no copy, and an
+// evicted image stays alive until its last user is done with it.
+class image_cache
+{
+    public:
+    image_cache() = delete;
+    explicit image_cache(const size_t max_bytes, const size_t num_shards = 64);
+
+    // returns nullptr if the image is not in the cache
+    auto get(const size_t index) -> std::shared_ptr<const cached_image>;
+    void put(const size_t index, std::shared_ptr<const cached_image> image);
+
+    size_t get_hits() const { return hits; }
+    size_t get_misses() const { return misses; }
+    size_t get_num_bytes() const;
+    size_t get_max_bytes() const { return max_bytes; }
+
+    private:
+    struct shard
+    {
+        using lru_list = std::list<size_t>;
+        struct entry
+        {
+            std::shared_ptr<const cached_image> image;
+            lru_list::iterator position;
+        };
+        mutable std::mutex mutex;
+        // the most recently used keys are at the front
+        lru_list lru;
+        std::unordered_map<size_t, entry> entries;
+        size_t num_bytes = 0;
+    };
+
+    shard& get_shard(const size_t index) { return shards[index % shards.size()]; }
+
+    size_t max_bytes;
+    size_t max_shard_bytes;
+    std::vector<shard> shards;
+    std::atomic<size_t> hits{0};
+    std::atomic<size_t> misses{0};
+};
+
+#endif  // image_cache_h_INCLUDED
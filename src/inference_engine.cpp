@@ -0,0 +1,108 @@
+#include "inference_engine.h"
+
+#include <map>
+
+using namespace dlib;
+
+inference_engine::inference_engine(
+    model& net,
+    const size_t batch_size,
+    const std::chrono::milliseconds max_delay,
+    const float conf)
+    : net(net),
+      batch_size(std::max<size_t>(batch_size, 1)),
+      max_delay(max_delay),
+      conf(conf),
+      requests(4 * this->batch_size),
+      worker([this]() { run(); })
+{
+}
+
+inference_engine::~inference_engine()
+{
+    requests.wait_until_empty();
+    requests.disable();
+    worker.join();
+}
+
+auto inference_engine::submit(matrix<rgb_pixel> image) -> std::future<std::vector<yolo_rect>>
+{
+    request r;
+    r.image = std::move(image);
+    auto detections = r.detections.get_future();
+    requests.enqueue(r);
+    return detections;
+}
+
+void inference_engine::process(bucket& b)
+{
+    std::vector<matrix<rgb_pixel>> images;
+    images.reserve(b.requests.size());
+    for (auto& r : b.requests)
+        images.push_back(std::move(r.image));
+    try
+    {
+        auto detections = net(images, batch_size, conf);
+        for (size_t i = 0; i < b.requests.size(); ++i)
+            b.requests[i].detections.set_value(std::move(detections[i]));
+    }
+    catch (...)
+    {
+        for (auto& r : b.requests)
+            r.detections.set_exception(std::current_exception());
+    }
+    b.requests.clear();
+}
+
+void inference_engine::run()
+{
+    using clock = std::chrono::steady_clock;
+    // the network can only batch images with the same size, so we keep one bucket per size
+    std::map<std::pair<long, long>, bucket> buckets;
+    request r;
+    while (true)
+    {
+        bool got_request = false;
+        if (buckets.empty())
+        {
+            got_request = requests.dequeue(r);
+        }
+        else
+        {
+            auto deadline = clock::time_point::max();
+            for (const auto& [size, b] : buckets)
+                deadline = std::min(deadline, b.deadline);
+            const auto timeout =
+                std::chrono::ceil<std::chrono::milliseconds>(deadline - clock::now()).count();
+            if (timeout > 0)
+                got_request = requests.dequeue_or_timeout(r, timeout);
+        }
+
+        if (got_request)
+        {
+            auto& b = buckets[{r.image.nr(), r.image.nc()}];
+            if (b.requests.empty())
+                b.deadline = clock::now() + max_delay;
+            b.requests.push_back(std::move(r));
+            if (b.requests.size() >= batch_size)
+                process(b);
+        }
+        else if (not requests.is_enabled())
+        {
+            for (auto& [size, b] : buckets)
+                process(b);
+            return;
+        }
+
+        const auto now = clock::now();
+        for (auto it = buckets.begin(); it != buckets.end();)
+        {
+            if (not it->second.requests.empty() and it->second.deadline <= now)
+                process(it->second);
+            if (it->second.requests.empty())
+                it = buckets.erase(it);
+            else
+                ++it;
+        }
+    }
+}
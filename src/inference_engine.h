@@ -0,0 +1,53 @@
+#ifndef inference_engine_h_INCLUDED
+#define inference_engine_h_INCLUDED
+
+#include "model.h"
+
+#include <dlib/pipe.h>
+#include <future>
+
+// Runs the network on a dedicated thread, grouping the images submitted from any number of
+// threads into mini-batches.  A batch is processed as soon as it has batch_size images of the
+// same size, or when its oldest image has waited for max_delay.  The engine must be the only
+// user of the model while it is alive.
+class inference_engine
+{
+    public:
+    inference_engine() = delete;
+    inference_engine(
+        model& net,
+        const size_t batch_size = 8,
+        const std::chrono::milliseconds max_delay = std::chrono::milliseconds(10),
+        const float conf = 0.25);
+    ~inference_engine();
+
+    // the image must already be preprocessed for the network
+    auto submit(dlib::matrix<dlib::rgb_pixel> image) -> std::future<std::vector<dlib::yolo_rect>>;
+
+    size_t get_batch_size() const { return batch_size; }
+
+    private:
+    struct request
+    {
+        dlib::matrix<dlib::rgb_pixel> image;
+        std::promise<std::vector<dlib::yolo_rect>> detections;
+    };
+
+    struct bucket
+    {
+        std::vector<request> requests;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    void run();
+    void process(bucket& b);
+
+    model& net;
+    size_t batch_size;
+    std::chrono::milliseconds max_delay;
+    float conf;
+    dlib::pipe<request> requests;
+    std::thread worker;
+};
+
+#endif  // inference_engine_h_INCLUDED
@@ -0,0 +1,291 @@
+#include "int8_conv.h"
+
+#include <algorithm>
+#include <cmath>
+#include <dlib/serialize.h>
+#include <dlib/threads.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    constexpr long row_alignment = 64;
+
+    // the output pixels processed together, so that their columns stay in the cache while all
+    // the filters go over them
+    constexpr long pixel_block = 32;
+
+#if defined(__AVX2__)
+    inline auto reduce_add(const __m256i a) -> int32_t
+    {
+        __m128i s = _mm_add_epi32(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(s);
+    }
+#endif
+
+    // Dot products of a column of quantized inputs with 4 consecutive rows of weights.  The
+    // inputs are unsigned and the weights signed, as required by VNNI.
+    void dot4(const uint8_t* x, const int8_t* w, const long size, int32_t* out)
+    {
+        const int8_t* w0 = w;
+        const int8_t* w1 = w + size;
+        const int8_t* w2 = w + 2 * size;
+        const int8_t* w3 = w + 3 * size;
+        long i = 0;
+#if defined(__AVX512VNNI__) && defined(__AVX512BW__)
+        __m512i a0 = _mm512_setzero_si512(), a1 = a0, a2 = a0, a3 = a0;
+        for (; i + 64 <= size; i += 64)
+        {
+            const __m512i v = _mm512_loadu_si512(x + i);
+            a0 = _mm512_dpbusd_epi32(a0, v, _mm512_loadu_si512(w0 + i));
+            a1 = _mm512_dpbusd_epi32(a1, v, _mm512_loadu_si512(w1 + i));
+            a2 = _mm512_dpbusd_epi32(a2, v, _mm512_loadu_si512(w2 + i));
+            a3 = _mm512_dpbusd_epi32(a3, v, _mm512_loadu_si512(w3 + i));
+        }
+        alignas(64) int32_t sums[4][16];
+        _mm512_store_si512(sums[0], a0);
+        _mm512_store_si512(sums[1], a1);
+        _mm512_store_si512(sums[2], a2);
+        _mm512_store_si512(sums[3], a3);
+        for (int j = 0; j < 4; ++j)
+        {
+            out[j] = 0;
+            for (int k = 0; k < 16; ++k)
+                out[j] += sums[j][k];
+        }
+#elif defined(__AVX2__)
+        __m256i a0 = _mm256_setzero_si256(), a1 = a0, a2 = a0, a3 = a0;
+#if defined(__AVXVNNI__)
+        const auto load = [](const auto* p)
+        { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); };
+        for (; i + 32 <= size; i += 32)
+        {
+            const __m256i v = load(x + i);
+            a0 = _mm256_dpbusd_avx_epi32(a0, v, load(w0 + i));
+            a1 = _mm256_dpbusd_avx_epi32(a1, v, load(w1 + i));
+            a2 = _mm256_dpbusd_avx_epi32(a2, v, load(w2 + i));
+            a3 = _mm256_dpbusd_avx_epi32(a3, v, load(w3 + i));
+        }
+#else
+        // without VNNI, the bytes are widened to 16 bits: maddubs would saturate
+        const auto widen = [](const int8_t* p)
+        { return _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))); };
+        for (; i + 16 <= size; i += 16)
+        {
+            const __m256i v =
+                _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i)));
+            a0 = _mm256_add_epi32(a0, _mm256_madd_epi16(v, widen(w0 + i)));
+            a1 = _mm256_add_epi32(a1, _mm256_madd_epi16(v, widen(w1 + i)));
+            a2 = _mm256_add_epi32(a2, _mm256_madd_epi16(v, widen(w2 + i)));
+            a3 = _mm256_add_epi32(a3, _mm256_madd_epi16(v, widen(w3 + i)));
+        }
+#endif
+        out[0] = reduce_add(a0);
+        out[1] = reduce_add(a1);
+        out[2] = reduce_add(a2);
+        out[3] = reduce_add(a3);
+#else
+        out[0] = out[1] = out[2] = out[3] = 0;
+#endif
+        for (; i < size; ++i)
+        {
+            out[0] += x[i] * w0[i];
+            out[1] += x[i] * w1[i];
+            out[2] += x[i] * w2[i];
+            out[3] += x[i] * w3[i];
+        }
+    }
+
+    void quantize_input(const float* input, const long size, const int8_input& q, uint8_t* output)
+    {
+        const float inv_scale = 1 / q.scale;
+        for (long i = 0; i < size; ++i)
+        {
+            const float v = std::nearbyint(input[i] * inv_scale) + q.zero_point;
+            output[i] = static_cast<uint8_t>(std::clamp(v, 0.f, 255.f));
+        }
+    }
+}  // namespace
+
+void quantize_filters(
+    const float* filters,
+    const float* biases,
+    const long num_filters,
+    const long k,
+    const long nr,
+    const long nc,
+    int8_filters& output)
+{
+    const long filter_size = k * nr * nc;
+    output.num_filters = num_filters;
+    output.k = k;
+    output.nr = nr;
+    output.nc = nc;
+    output.row_size = (filter_size + row_alignment - 1) / row_alignment * row_alignment;
+    // the rows are padded to a multiple of 4 filters for dot4
+    const long num_rows = (num_filters + 3) / 4 * 4;
+    output.weights.assign(num_rows * output.row_size, 0);
+    output.scales.assign(num_filters, 1);
+    output.sums.assign(num_filters, 0);
+    output.biases.clear();
+    if (biases)
+        output.biases.assign(biases, biases + num_filters);
+    for (long f = 0; f < num_filters; ++f)
+    {
+        const float* w = filters + f * filter_size;
+        float max_abs = 0;
+        for (long i = 0; i < filter_size; ++i)
+            max_abs = std::max(max_abs, std::abs(w[i]));
+        if (max_abs > 0)
+            output.scales[f] = max_abs / 127;
+        int8_t* row = output.weights.data() + f * output.row_size;
+        for (long i = 0; i < filter_size; ++i)
+        {
+            const float v = std::nearbyint(w[i] / output.scales[f]);
+            row[i] = static_cast<int8_t>(std::clamp(v, -127.f, 127.f));
+            output.sums[f] += row[i];
+        }
+    }
+}
+
+auto get_input_quantization(const float min_value, const float max_value) -> int8_input
+{
+    const float low = std::min(min_value, 0.f);
+    const float high = std::max(max_value, 0.f);
+    int8_input q;
+    if (high > low)
+        q.scale = (high - low) / 255;
+    q.zero_point = std::clamp<int>(std::lround(-low / q.scale), 0, 255);
+    return q;
+}
+
+void int8_conv(
+    const float* input,
+    const long num_samples,
+    const long nr,
+    const long nc,
+    const int8_input& quantization,
+    const int8_filters& filters,
+    const int stride_y,
+    const int stride_x,
+    const int padding_y,
+    const int padding_x,
+    float* output,
+    const long out_nr,
+    const long out_nc)
+{
+    const long k = filters.k;
+    const long plane_size = nr * nc;
+    const long out_plane_size = out_nr * out_nc;
+    const long row_size = filters.row_size;
+    const uint8_t zero_point = quantization.zero_point;
+
+    thread_local std::vector<uint8_t> quantized;
+    quantized.resize(num_samples * k * plane_size);
+    quantize_input(input, quantized.size(), quantization, quantized.data());
+    // the workers have their own thread_local buffers, so they get the data of this one
+    const uint8_t* const samples = quantized.data();
+
+    const long blocks_per_sample = (out_plane_size + pixel_block - 1) / pixel_block;
+    dlib::parallel_for(
+        0,
+        num_samples * blocks_per_sample,
+        [&](const long b)
+        {
+            const long n = b / blocks_per_sample;
+            const long begin = (b % blocks_per_sample) * pixel_block;
+            const long end = std::min(begin + pixel_block, out_plane_size);
+            const uint8_t* sample = samples + n * k * plane_size;
+
+            // gather the input window of each output pixel, in the order of the weights
+            thread_local std::vector<uint8_t> columns;
+            columns.resize(pixel_block * row_size);
+            for (long p = begin; p < end; ++p)
+            {
+                uint8_t* const first = columns.data() + (p - begin) * row_size;
+                uint8_t* col = first;
+                const long y0 = (p / out_nc) * stride_y - padding_y;
+                const long x0 = (p % out_nc) * stride_x - padding_x;
+                for (long c = 0; c < k; ++c)
+                {
+                    const uint8_t* plane = sample + c * plane_size;
+                    for (long ky = 0; ky < filters.nr; ++ky)
+                    {
+                        const long y = y0 + ky;
+                        for (long kx = 0; kx < filters.nc; ++kx, ++col)
+                        {
+                            const long x = x0 + kx;
+                            const bool inside = y >= 0 and y < nr and x >= 0 and x < nc;
+                            *col = inside ? plane[y * nc + x] : zero_point;
+                        }
+                    }
+                }
+                std::fill(col, first + row_size, 0);
+            }
+
+            float* out = output + n * filters.num_filters * out_plane_size;
+            int32_t acc[4];
+            for (long f = 0; f < filters.num_filters; f += 4)
+            {
+                const int8_t* w = filters.weights.data() + f * row_size;
+                const long num = std::min<long>(4, filters.num_filters - f);
+                for (long p = begin; p < end; ++p)
+                {
+                    dot4(columns.data() + (p - begin) * row_size, w, row_size, acc);
+                    for (long i = 0; i < num; ++i)
+                    {
+                        const long o = f + i;
+                        const int32_t v = acc[i] - quantization.zero_point * filters.sums[o];
+                        float value = v * quantization.scale * filters.scales[o];
+                        if (not filters.biases.empty())
+                            value += filters.biases[o];
+                        out[o * out_plane_size + p] = value;
+                    }
+                }
+            }
+        });
+}
+
+void serialize(const int8_filters& item, std::ostream& out)
+{
+    dlib::serialize("int8_filters", out);
+    dlib::serialize(item.num_filters, out);
+    dlib::serialize(item.k, out);
+    dlib::serialize(item.nr, out);
+    dlib::serialize(item.nc, out);
+    dlib::serialize(item.row_size, out);
+    dlib::serialize(item.weights.size(), out);
+    out.write(reinterpret_cast<const char*>(item.weights.data()), item.weights.size());
+    dlib::serialize(item.scales, out);
+    dlib::serialize(item.sums, out);
+    dlib::serialize(item.biases, out);
+}
+
+void deserialize(int8_filters& item, std::istream& in)
+{
+    std::string version;
+    dlib::deserialize(version, in);
+    if (version != "int8_filters")
+    {
+        throw dlib::serialization_error(
+            "Unexpected version found while deserializing int8_filters");
+    }
+    dlib::deserialize(item.num_filters, in);
+    dlib::deserialize(item.k, in);
+    dlib::deserialize(item.nr, in);
+    dlib::deserialize(item.nc, in);
+    dlib::deserialize(item.row_size, in);
+    size_t size;
+    dlib::deserialize(size, in);
+    item.weights.resize(size);
+    in.read(reinterpret_cast<char*>(item.weights.data()), size);
+    if (not in)
+        throw dlib::serialization_error("Error reading the weights of int8_filters");
+    dlib::deserialize(item.scales, in);
+    dlib::deserialize(item.sums, in);
+    dlib::deserialize(item.biases, in);
+}
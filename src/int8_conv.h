@@ -0,0 +1,71 @@
+#ifndef int8_conv_h_INCLUDED
+#define int8_conv_h_INCLUDED
+
+#include "weight_buffer.h"
+
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+// The filters of a convolution quantized to 8 bits, symmetrically for each output channel.  Each
+// filter is stored as a row of k * nr * nc weights, in the order of dlib::con_, padded with zeros
+// to a multiple of 64 bytes for the SIMD dot products.
+struct int8_filters
+{
+    long num_filters = 0;
+    long k = 0;
+    long nr = 0;
+    long nc = 0;
+    long row_size = 0;
+    weight_buffer<int8_t> weights;
+    std::vector<float> scales;
+    // sum of the quantized weights of each filter, to remove the zero point of the input
+    std::vector<int32_t> sums;
+    // empty if the convolution has no bias
+    std::vector<float> biases;
+};
+
+// The asymmetric 8-bit quantization of the input of a convolution: x = scale * (q - zero_point)
+struct int8_input
+{
+    float scale = 1;
+    int zero_point = 0;
+};
+
+// Quantizes the num_filters x k x nr x nc filters and the optional biases of a dlib::con_
+void quantize_filters(
+    const float* filters,
+    const float* biases,
+    const long num_filters,
+    const long k,
+    const long nr,
+    const long nc,
+    int8_filters& output);
+
+// The quantization of a range of values, extended to contain 0 so that the zero padding of the
+// convolution is exact.
+auto get_input_quantization(const float min_value, const float max_value) -> int8_input;
+
+// Convolution of the num_samples x k x nr x nc input with the quantized filters, written as
+// num_samples x num_filters x out_nr x out_nc floats.  The input is quantized with the given
+// parameters, and the dot products use VNNI with AVX-512 or AVX, madd with AVX2, or scalar code,
+// depending on what the build enables.  The output pixels are spread over the dlib threads.
+void int8_conv(
+    const float* input,
+    const long num_samples,
+    const long nr,
+    const long nc,
+    const int8_input& quantization,
+    const int8_filters& filters,
+    const int stride_y,
+    const int stride_x,
+    const int padding_y,
+    const int padding_x,
+    float* output,
+    const long out_nr,
+    const long out_nc);
+
+void serialize(const int8_filters& item, std::ostream& out);
+void deserialize(int8_filters& item, std::istream& in);
+
+#endif  // int8_conv_h_INCLUDED
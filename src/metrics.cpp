@@ -1,18 +1,21 @@
 #include "metrics.h"
 
 #include "detector_utils.h"
+#include "packed_dataset.h"
 
 test_data_loader::test_data_loader(
     const std::string& dataset_dir,
     const dlib::image_dataset_metadata::dataset& dataset,
     dlib::pipe<image_info>& data,
     long image_size,
-    size_t num_workers)
+    size_t num_workers,
+    const packed_dataset* packed)
     : dataset_dir(dataset_dir),
       dataset(dataset),
       data(data),
       image_size(image_size),
-      num_workers(num_workers)
+      num_workers(num_workers),
+      packed(packed)
 {
 }
 
@@ -26,13 +29,348 @@ void test_data_loader::run()
         {
             dlib::matrix<dlib::rgb_pixel> image;
             image_info temp;
-            dlib::load_image(image, dataset_dir + "/" + dataset.images[i].filename);
             temp.info = dataset.images[i];
-            temp.tform = preprocess_image(image, temp.image, image_size);
+            if (packed)
+            {
+                temp.tform = dlib::rectangle_transform(inv(packed->load(i, temp.image)));
+            }
+            else
+            {
+                dlib::load_image(image, dataset_dir + "/" + dataset.images[i].filename);
+                temp.tform = preprocess_image(image, temp.image, image_size);
+            }
             data.enqueue(temp);
         });
 }
 
+detection_evaluator::detection_evaluator(
+    const std::vector<std::string>& labels,
+    const double conf_thresh,
+    const size_t num_bins)
+    : labels(labels),
+      conf_thresh(conf_thresh),
+      num_bins(std::max<size_t>(num_bins, 1))
+{
+    std::sort(this->labels.begin(), this->labels.end());
+    stats.resize(this->labels.size());
+    for (auto& s : stats)
+    {
+        s.tp_bins.assign(this->num_bins, 0);
+        s.fp_bins.assign(this->num_bins, 0);
+        s.coco_tp_bins.assign(num_coco_areas * num_coco_ious * this->num_bins, 0);
+        s.coco_fp_bins.assign(num_coco_areas * num_coco_ious * this->num_bins, 0);
+    }
+    dets_by_label.resize(this->labels.size());
+    truths_by_label.resize(this->labels.size());
+}
+
+auto detection_evaluator::get_label_index(const std::string& label) const -> size_t
+{
+    const auto it = std::lower_bound(labels.begin(), labels.end(), label);
+    if (it == labels.end() or *it != label)
+        throw std::runtime_error("ERROR: unknown label " + label);
+    return it - labels.begin();
+}
+
+auto detection_evaluator::get_bin(const double confidence) const -> size_t
+{
+    return std::min(static_cast<size_t>(std::max(confidence, 0.) * num_bins), num_bins - 1);
+}
+
+void detection_evaluator::add(
+    const dlib::image_dataset_metadata::image& truth,
+    const std::vector<dlib::yolo_rect>& dets)
+{
+    // Only the detections with the same label as a truth box can match it, so the detections
+    // are grouped by label, in order of decreasing confidence.
+    for (auto& indices : dets_by_label)
+        indices.clear();
+    for (auto& indices : truths_by_label)
+        indices.clear();
+    for (size_t d = 0; d < dets.size(); ++d)
+        dets_by_label[get_label_index(dets[d].label)].push_back(d);
+    for (size_t t = 0; t < truth.boxes.size(); ++t)
+        truths_by_label[get_label_index(truth.boxes[t].label)].push_back(t);
+    for (size_t label = 0; label < labels.size(); ++label)
+    {
+        if (not dets_by_label[label].empty() or not truths_by_label[label].empty())
+            add_coco(label, truth, dets);
+    }
+
+    used.assign(dets.size(), false);
+    const size_t num_pr = std::count_if(
+        dets.begin(),
+        dets.end(),
+        [this](const auto& d) { return d.detection_confidence >= conf_thresh; });
+
+    // true positives: truths matched by detections
+    for (const auto& box : truth.boxes)
+    {
+        const auto label = get_label_index(box.label);
+        auto& s = stats[label];
+        const dlib::drectangle truth_rect(box.rect);
+        bool found_match_ap = false;
+        bool found_match_pr = false;
+        for (const auto d : dets_by_label[label])
+        {
+            if (used[d] or box_intersection_over_union(truth_rect, dets[d].rect) < 0.5)
+                continue;
+            used[d] = true;
+            found_match_ap = true;
+            s.tp_bins[get_bin(dets[d].detection_confidence)]++;
+            if (d < num_pr)
+            {
+                found_match_pr = true;
+                s.pr.tp++;
+            }
+            break;
+        }
+        // false negatives: truths not matched
+        if (not found_match_ap)
+            s.missing++;
+        if (not found_match_pr)
+            s.pr.fn++;
+    }
+    // false positives: detections not matched
+    for (size_t d = 0; d < dets.size(); ++d)
+    {
+        if (used[d])
+            continue;
+        auto& s = stats[get_label_index(dets[d].label)];
+        s.fp_bins[get_bin(dets[d].detection_confidence)]++;
+        if (d < num_pr)
+            s.pr.fp++;
+    }
+}
+
+namespace
+{
+    // the boxes as written by xml2coco and evalcoco
+    auto to_coco_box(const dlib::rectangle& r) -> dlib::drectangle
+    {
+        return dlib::drectangle(r.left(), r.top(), r.left() + r.width(), r.top() + r.height());
+    }
+
+    bool is_in_area(const double area, const coco_area range)
+    {
+        switch (range)
+        {
+        case coco_area::all:
+            return true;
+        case coco_area::small:
+            return area <= 32 * 32;
+        case coco_area::medium:
+            return area >= 32 * 32 and area <= 96 * 96;
+        case coco_area::large:
+            return area >= 96 * 96;
+        }
+        return true;
+    }
+}  // namespace
+
+void detection_evaluator::add_coco(
+    const size_t label,
+    const dlib::image_dataset_metadata::image& truth,
+    const std::vector<dlib::yolo_rect>& dets)
+{
+    auto& s = stats[label];
+    const auto& truths = truths_by_label[label];
+    const auto& all_dets = dets_by_label[label];
+    const size_t num_dets = std::min(all_dets.size(), max_coco_detections);
+    const size_t num_truths = truths.size();
+    ious.resize(num_dets * num_truths);
+    for (size_t d = 0; d < num_dets; ++d)
+    {
+        for (size_t t = 0; t < num_truths; ++t)
+        {
+            ious[d * num_truths + t] = box_intersection_over_union(
+                to_coco_box(truth.boxes[truths[t]].rect),
+                dets[all_dets[d]].rect);
+        }
+    }
+
+    for (size_t a = 0; a < num_coco_areas; ++a)
+    {
+        const auto area = static_cast<coco_area>(a);
+        // the truths outside of the area range are ignored, and matched last
+        truth_ignored.resize(num_truths);
+        truth_order.clear();
+        for (size_t t = 0; t < num_truths; ++t)
+        {
+            truth_ignored[t] = not is_in_area(truth.boxes[truths[t]].rect.area(), area);
+            if (not truth_ignored[t])
+                truth_order.push_back(t);
+        }
+        s.coco_truths[a] += truth_order.size();
+        for (size_t t = 0; t < num_truths; ++t)
+        {
+            if (truth_ignored[t])
+                truth_order.push_back(t);
+        }
+
+        for (size_t i = 0; i < num_coco_ious; ++i)
+        {
+            const auto offset = (a * num_coco_ious + i) * num_bins;
+            truth_matched.assign(num_truths, false);
+            for (size_t d = 0; d < num_dets; ++d)
+            {
+                const auto& det = dets[all_dets[d]];
+                // the best unmatched truth, preferring the ones in the area range
+                double best_iou = std::min(get_coco_iou_threshold(i), 1 - 1e-10);
+                long best = -1;
+                for (const auto t : truth_order)
+                {
+                    if (truth_matched[t])
+                        continue;
+                    if (best != -1 and not truth_ignored[best] and truth_ignored[t])
+                        break;
+                    if (ious[d * num_truths + t] < best_iou)
+                        continue;
+                    best_iou = ious[d * num_truths + t];
+                    best = t;
+                }
+                bool ignored;
+                if (best != -1)
+                {
+                    truth_matched[best] = true;
+                    ignored = truth_ignored[best];
+                }
+                else
+                {
+                    ignored = not is_in_area(det.rect.area(), area);
+                }
+                if (ignored)
+                    continue;
+                const auto bin = offset + get_bin(det.detection_confidence);
+                if (best != -1)
+                    s.coco_tp_bins[bin]++;
+                else
+                    s.coco_fp_bins[bin]++;
+            }
+        }
+    }
+}
+
+void detection_evaluator::merge(const detection_evaluator& other)
+{
+    DLIB_CASSERT(labels == other.labels and num_bins == other.num_bins);
+    for (size_t i = 0; i < stats.size(); ++i)
+    {
+        auto& s = stats[i];
+        const auto& o = other.stats[i];
+        for (size_t b = 0; b < num_bins; ++b)
+        {
+            s.tp_bins[b] += o.tp_bins[b];
+            s.fp_bins[b] += o.fp_bins[b];
+        }
+        for (size_t b = 0; b < s.coco_tp_bins.size(); ++b)
+        {
+            s.coco_tp_bins[b] += o.coco_tp_bins[b];
+            s.coco_fp_bins[b] += o.coco_fp_bins[b];
+        }
+        for (size_t a = 0; a < num_coco_areas; ++a)
+            s.coco_truths[a] += o.coco_truths[a];
+        s.missing += o.missing;
+        s.pr.tp += o.pr.tp;
+        s.pr.fp += o.pr.fp;
+        s.pr.fn += o.pr.fn;
+    }
+}
+
+double detection_evaluator::get_average_precision(const size_t label) const
+{
+    // Same as dlib::average_precision, where the detections in a bin come in a row, the true
+    // positives first.  The precision increases along the true positives of a bin, so they all
+    // share the interpolated precision of the last one.
+    const auto& s = stats[label];
+    std::vector<double> precisions(num_bins, 0);
+    double tp = 0, retrieved = 0;
+    for (size_t b = num_bins; b-- > 0;)
+    {
+        tp += s.tp_bins[b];
+        retrieved += s.tp_bins[b];
+        if (s.tp_bins[b] > 0)
+            precisions[b] = tp / retrieved;
+        retrieved += s.fp_bins[b];
+    }
+    double precision_sum = 0;
+    double max_precision = 0;
+    for (size_t b = 0; b < num_bins; ++b)
+    {
+        max_precision = std::max(max_precision, precisions[b]);
+        precision_sum += max_precision * s.tp_bins[b];
+    }
+    const double relevant = tp + s.missing;
+    return relevant == 0 ? 1 : precision_sum / relevant;
+}
+
+double detection_evaluator::get_coco_average_precision(
+    const size_t label,
+    const coco_area area,
+    const size_t iou) const
+{
+    const auto& s = stats[label];
+    const auto a = static_cast<size_t>(area);
+    const double num_truths = s.coco_truths[a];
+    if (num_truths == 0)
+        return -1;
+    const auto* tp_bins = &s.coco_tp_bins[(a * num_coco_ious + iou) * num_bins];
+    const auto* fp_bins = &s.coco_fp_bins[(a * num_coco_ious + iou) * num_bins];
+
+    // The recall only changes on true positives, which come first in each bin, and the
+    // precision increases along them, so the precision envelope is the same for all the true
+    // positives of a bin: the one after its last true positive, or a later one if higher.
+    std::vector<double> recalls(num_bins, -1), precisions(num_bins, 0);
+    double tp = 0, retrieved = 0;
+    for (size_t b = num_bins; b-- > 0;)
+    {
+        tp += tp_bins[b];
+        retrieved += tp_bins[b];
+        if (tp_bins[b] > 0)
+        {
+            recalls[b] = tp / num_truths;
+            precisions[b] = tp / retrieved;
+        }
+        retrieved += fp_bins[b];
+    }
+    for (size_t b = 1; b < num_bins; ++b)
+        precisions[b] = std::max(precisions[b], precisions[b - 1]);
+
+    // 101-point interpolation: the precision at the first point reaching each recall
+    double sum = 0;
+    size_t b = num_bins;
+    for (size_t r = 0; r <= 100; ++r)
+    {
+        const double recall = r / 100.;
+        while (b > 0 and recalls[b - 1] < recall)
+            --b;
+        if (b == 0)
+            break;
+        sum += precisions[b - 1];
+    }
+    return sum / 101;
+}
+
+double detection_evaluator::get_coco_map(const coco_area area, const long iou) const
+{
+    double sum = 0;
+    size_t count = 0;
+    for (size_t label = 0; label < labels.size(); ++label)
+    {
+        for (size_t i = 0; i < num_coco_ious; ++i)
+        {
+            if (iou >= 0 and static_cast<size_t>(iou) != i)
+                continue;
+            const auto ap = get_coco_average_precision(label, area, i);
+            if (ap < 0)
+                continue;
+            sum += ap;
+            ++count;
+        }
+    }
+    return count == 0 ? -1 : sum / count;
+}
+
 metrics_details compute_metrics(
     model& net,
     const dlib::image_dataset_metadata::dataset& dataset,
@@ -41,20 +379,26 @@ metrics_details compute_metrics(
     const double conf_thresh,
     std::ostream& out)
 {
-    std::map<std::string, result> results;
-    std::map<std::string, std::vector<std::pair<double, bool>>> hits;
-    std::map<std::string, unsigned long> missing;
+    const auto& labels = net.get_options().labels;
     // category padding: among class, micro, macro and weighted, the weighted is the longest
     size_t padding = std::string("weighted").length();
-    for (const auto& label : net.get_options().labels)
-    {
-        hits[label] = std::vector<std::pair<double, bool>>();
-        missing[label] = 0;
+    for (const auto& label : labels)
         padding = std::max(label.length(), padding);
-    }
     // Add two extra spaces for padding in case
     padding += 2;
 
+    // Each part of a batch is evaluated by a different thread, and the parts are merged at the
+    // end, so the results do not depend on the scheduling.  The matching is cheap compared to
+    // the inference, and a few parts are enough to keep up while bounding the memory used by
+    // the histograms.
+    const size_t num_parts = std::clamp<size_t>(
+        std::thread::hardware_concurrency(),
+        1,
+        std::clamp<size_t>(batch_size, 1, 4));
+    std::vector<detection_evaluator> evaluators(
+        num_parts,
+        detection_evaluator(labels, conf_thresh));
+
     // process the dataset
     size_t num_processed = 0;
     const size_t offset = dataset.images.size() % batch_size;
@@ -74,62 +418,27 @@ metrics_details compute_metrics(
         }
         auto detections_batch = net(images, batch_size, 0.001);
 
-        for (size_t i = 0; i < images.size(); ++i)
-        {
-            const auto& im = details[i].info;
-            auto& dets = detections_batch[i];
-            postprocess_detections(details[i].tform, dets);
-            std::vector<bool> used(dets.size(), false);
-            const size_t num_pr = std::count_if(
-                dets.begin(),
-                dets.end(),
-                [conf_thresh](const auto& d) { return d.detection_confidence >= conf_thresh; });
-            // true positives: truths matched by detections
-            for (size_t t = 0; t < im.boxes.size(); ++t)
+        dlib::parallel_for(
+            num_parts,
+            0,
+            num_parts,
+            [&](const size_t part)
             {
-                bool found_match_ap = false;
-                bool found_match_pr = false;
-                for (size_t d = 0; d < dets.size(); ++d)
+                const size_t begin = part * images.size() / num_parts;
+                const size_t end = (part + 1) * images.size() / num_parts;
+                for (size_t i = begin; i < end; ++i)
                 {
-                    if (used[d])
-                        continue;
-                    if (im.boxes[t].label == dets[d].label &&
-                        box_intersection_over_union(
-                            dlib::drectangle(im.boxes[t].rect),
-                            dets[d].rect) >= 0.5)
-                    {
-                        used[d] = true;
-                        found_match_ap = true;
-                        hits.at(dets[d].label).emplace_back(dets[d].detection_confidence, true);
-                        if (d < num_pr)
-                        {
-                            found_match_pr = true;
-                            results[dets[d].label].tp++;
-                        }
-                        break;
-                    }
-                }
-                // false negatives: truths not matched
-                if (!found_match_ap)
-                    missing.at(im.boxes[t].label)++;
-                if (!found_match_pr)
-                    results[im.boxes[t].label].fn++;
-            }
-            // false positives: detections not matched
-            for (size_t d = 0; d < dets.size(); ++d)
-            {
-                if (!used[d])
-                {
-                    hits.at(dets[d].label).emplace_back(dets[d].detection_confidence, false);
-                    if (d < num_pr)
-                        results[dets[d].label].fp++;
+                    postprocess_detections(details[i].tform, detections_batch[i]);
+                    evaluators[part].add(details[i].info, detections_batch[i]);
                 }
-            }
-        }
+            });
         num_processed += images.size();
         progress.print_status(num_processed);
     }
     progress.finish();
+    auto& evaluator = evaluators.front();
+    for (size_t part = 1; part < num_parts; ++part)
+        evaluator.merge(evaluators[part]);
 
     metrics_details metrics;
     result micro;
@@ -144,11 +453,11 @@ metrics_details compute_metrics(
         << dlib::lpad(std::string("fn"), 12)
         << dlib::lpad(std::string("support"), 12) << '\n';
     // clang-format on
-    for (auto& item : hits)
+    const auto& sorted_labels = evaluator.get_labels();
+    for (size_t label = 0; label < sorted_labels.size(); ++label)
     {
-        std::sort(item.second.rbegin(), item.second.rend());
-        const double ap = dlib::average_precision(item.second, missing[item.first]);
-        const auto& r = results.at(item.first);
+        const double ap = evaluator.get_average_precision(label);
+        const auto& r = evaluator.get_result(label);
         micro.tp += r.tp;
         micro.fp += r.fp;
         micro.fn += r.fn;
@@ -159,7 +468,7 @@ metrics_details compute_metrics(
         metrics.weighted_r += r.recall() * r.support();
         metrics.weighted_f += r.f1_score() * r.support();
         // clang-format off
-        out << dlib::rpad(item.first, padding)
+        out << dlib::rpad(sorted_labels[label], padding)
                   << std::setprecision(4) << std::right << std::fixed
                   << std::setw(12) << ap
                   << std::setprecision(4)
@@ -179,10 +488,10 @@ metrics_details compute_metrics(
     for (const auto& im : dataset.images)
         num_boxes += im.boxes.size();
 
-    metrics.map /= hits.size();
-    metrics.macro_p /= results.size();
-    metrics.macro_r /= results.size();
-    metrics.macro_f /= results.size();
+    metrics.map /= sorted_labels.size();
+    metrics.macro_p /= sorted_labels.size();
+    metrics.macro_r /= sorted_labels.size();
+    metrics.macro_f /= sorted_labels.size();
     metrics.micro_p = micro.precision();
     metrics.micro_r = micro.recall();
     metrics.micro_f = micro.f1_score();
@@ -212,9 +521,89 @@ metrics_details compute_metrics(
               << std::setw(12) << metrics.weighted_f
               << std::endl;
     // clang-format on
+
+    metrics.coco_map = evaluator.get_coco_map();
+    metrics.coco_map_50 = evaluator.get_coco_map(coco_area::all, 0);
+    metrics.coco_map_75 = evaluator.get_coco_map(coco_area::all, 5);
+    metrics.coco_map_small = evaluator.get_coco_map(coco_area::small);
+    metrics.coco_map_medium = evaluator.get_coco_map(coco_area::medium);
+    metrics.coco_map_large = evaluator.get_coco_map(coco_area::large);
+    const std::array<std::pair<std::string, double>, 6> coco_metrics{{
+        {"AP@[.50:.95]", metrics.coco_map},
+        {"AP@.50", metrics.coco_map_50},
+        {"AP@.75", metrics.coco_map_75},
+        {"AP@[.50:.95] small", metrics.coco_map_small},
+        {"AP@[.50:.95] medium", metrics.coco_map_medium},
+        {"AP@[.50:.95] large", metrics.coco_map_large},
+    }};
+    out << "--" << std::endl;
+    for (const auto& [name, value] : coco_metrics)
+    {
+        out << dlib::rpad("COCO " + name, 25) << std::setprecision(4) << std::right << std::fixed
+            << std::setw(12) << value << std::endl;
+    }
     return metrics;
 }
 
+void serialize(const metrics_details& item, std::ostream& out)
+{
+    dlib::serialize(item.map, out);
+    dlib::serialize(item.macro_p, out);
+    dlib::serialize(item.macro_r, out);
+    dlib::serialize(item.macro_f, out);
+    dlib::serialize(item.micro_p, out);
+    dlib::serialize(item.micro_r, out);
+    dlib::serialize(item.micro_f, out);
+    dlib::serialize(item.weighted_p, out);
+    dlib::serialize(item.weighted_r, out);
+    dlib::serialize(item.weighted_f, out);
+    dlib::serialize(std::string("coco"), out);
+    dlib::serialize(item.coco_map, out);
+    dlib::serialize(item.coco_map_50, out);
+    dlib::serialize(item.coco_map_75, out);
+    dlib::serialize(item.coco_map_small, out);
+    dlib::serialize(item.coco_map_medium, out);
+    dlib::serialize(item.coco_map_large, out);
+}
+
+void deserialize(metrics_details& item, std::istream& in)
+{
+    dlib::deserialize(item.map, in);
+    dlib::deserialize(item.macro_p, in);
+    dlib::deserialize(item.macro_r, in);
+    dlib::deserialize(item.macro_f, in);
+    dlib::deserialize(item.micro_p, in);
+    dlib::deserialize(item.micro_r, in);
+    dlib::deserialize(item.micro_f, in);
+    dlib::deserialize(item.weighted_p, in);
+    dlib::deserialize(item.weighted_r, in);
+    dlib::deserialize(item.weighted_f, in);
+    // The COCO metrics were added later: older files go on with whatever was saved after them.
+    const auto pos = in.tellg();
+    std::string tag;
+    try
+    {
+        dlib::deserialize(tag, in);
+    }
+    catch (const dlib::serialization_error&)
+    {
+    }
+    if (tag != "coco")
+    {
+        in.clear();
+        in.seekg(pos);
+        item.coco_map = item.coco_map_50 = item.coco_map_75 = 0;
+        item.coco_map_small = item.coco_map_medium = item.coco_map_large = 0;
+        return;
+    }
+    dlib::deserialize(item.coco_map, in);
+    dlib::deserialize(item.coco_map_50, in);
+    dlib::deserialize(item.coco_map_75, in);
+    dlib::deserialize(item.coco_map_small, in);
+    dlib::deserialize(item.coco_map_medium, in);
+    dlib::deserialize(item.coco_map_large, in);
+}
+
 void save_model(
     model& net,
     const std::string& name,
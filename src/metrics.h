@@ -6,6 +6,8 @@
 #include <dlib/data_io.h>
 #include <dlib/pipe.h>
 
+class packed_dataset;
+
 struct result
 {
     result() = default;
@@ -30,6 +32,7 @@ struct image_info
     dlib::rectangle_transform tform;
 };
 
+// Loads and letterboxes the images of the dataset, from the packed dataset if one is given.
 class test_data_loader
 {
     public:
@@ -39,7 +42,8 @@ class test_data_loader
         const dlib::image_dataset_metadata::dataset& dataset,
         dlib::pipe<image_info>& data,
         long image_size = 512,
-        size_t num_workers = std::thread::hardware_concurrency());
+        size_t num_workers = std::thread::hardware_concurrency(),
+        const packed_dataset* packed = nullptr);
 
     void run();
 
@@ -49,6 +53,98 @@ class test_data_loader
     dlib::pipe<image_info>& data;
     long image_size;
     size_t num_workers;
+    const packed_dataset* packed;
+};
+
+// The area ranges of the COCO evaluation, using the area of the boxes
+enum class coco_area
+{
+    all,     // any size
+    small,   // below 32x32
+    medium,  // between 32x32 and 96x96
+    large,   // above 96x96
+};
+
+// Accumulates the results of a detector over any number of images in a fixed amount of memory.
+// The confidences of the detections are binned in per-class histograms, and the average
+// precision is computed as if the detections falling in the same bin had the same confidence.
+// The precision, recall and F1-score use the detections above conf_thresh.  Partial results,
+// for example computed by different threads, can be merged.
+//
+// Besides the AP at IoU 0.5 of dlib::average_precision, it computes the COCO metrics like
+// pycocotools does for bounding boxes: the 101-point interpolated AP at the IoU thresholds
+// 0.50:0.05:0.95, for each area range, with the best 100 detections per image and class.  The
+// IoU between the truths and the detections of each class is computed once per image, and all
+// the thresholds and area ranges are matched from it.
+class detection_evaluator
+{
+    public:
+    static constexpr size_t num_coco_ious = 10;
+    static constexpr size_t num_coco_areas = 4;
+    static constexpr size_t max_coco_detections = 100;
+
+    detection_evaluator() = delete;
+    detection_evaluator(
+        const std::vector<std::string>& labels,
+        const double conf_thresh = 0.25,
+        const size_t num_bins = 1000);
+
+    // Matches the detections, sorted by decreasing confidence, to the truth boxes of the image.
+    void add(
+        const dlib::image_dataset_metadata::image& truth,
+        const std::vector<dlib::yolo_rect>& detections);
+
+    void merge(const detection_evaluator& other);
+
+    // the labels are sorted by name
+    const std::vector<std::string>& get_labels() const { return labels; }
+    const result& get_result(const size_t label) const { return stats[label].pr; }
+    double get_average_precision(const size_t label) const;
+
+    static double get_coco_iou_threshold(const size_t iou) { return 0.5 + 0.05 * iou; }
+
+    // COCO AP of a class at the IoU threshold of index iou, or -1 if it has no truth boxes
+    double get_coco_average_precision(
+        const size_t label,
+        const coco_area area,
+        const size_t iou) const;
+
+    // mean of the COCO AP over the classes with truth boxes and over the IoU thresholds, or only
+    // at the IoU threshold of index iou if it is given
+    double get_coco_map(const coco_area area = coco_area::all, const long iou = -1) const;
+
+    private:
+    struct class_stats
+    {
+        std::vector<unsigned long> tp_bins;
+        std::vector<unsigned long> fp_bins;
+        unsigned long missing = 0;
+        result pr;
+        // indexed by area range, IoU threshold and bin
+        std::vector<unsigned int> coco_tp_bins;
+        std::vector<unsigned int> coco_fp_bins;
+        std::array<unsigned long, num_coco_areas> coco_truths{};
+    };
+
+    auto get_label_index(const std::string& label) const -> size_t;
+    auto get_bin(const double confidence) const -> size_t;
+    void add_coco(
+        const size_t label,
+        const dlib::image_dataset_metadata::image& truth,
+        const std::vector<dlib::yolo_rect>& detections);
+
+    std::vector<std::string> labels;
+    double conf_thresh;
+    size_t num_bins;
+    std::vector<class_stats> stats;
+    // scratch buffers reused between images
+    std::vector<bool> used;
+    std::vector<std::vector<size_t>> dets_by_label;
+    std::vector<std::vector<size_t>> truths_by_label;
+    std::vector<double> ious;
+    std::vector<size_t> truth_order;
+    std::vector<bool> truth_ignored;
+    std::vector<bool> truth_matched;
 };
 
 struct metrics_details
@@ -63,25 +159,25 @@ struct metrics_details
     double weighted_p = 0;
     double weighted_r = 0;
     double weighted_f = 0;
-    DLIB_DEFINE_DEFAULT_SERIALIZATION(
-        metrics_details,
-        map,
-        macro_p,
-        macro_r,
-        macro_f,
-        micro_p,
-        micro_r,
-        micro_f,
-        weighted_p,
-        weighted_r,
-        weighted_f);
+    // COCO mAP@[.50:.95], at IoU 0.50 and 0.75, and for each area range
+    double coco_map = 0;
+    double coco_map_50 = 0;
+    double coco_map_75 = 0;
+    double coco_map_small = 0;
+    double coco_map_medium = 0;
+    double coco_map_large = 0;
 };
 
+void serialize(const metrics_details& item, std::ostream& out);
+void deserialize(metrics_details& item, std::istream& in);
+
 inline std::ostream& operator<<(std::ostream& out, const metrics_details& item)
 {
     out << item.map << ' ' << item.macro_p << ' ' << item.macro_r << ' ' << item.macro_f << ' '
         << item.micro_p << ' ' << item.micro_r << ' ' << item.micro_f << ' ' << item.weighted_p
-        << ' ' << item.weighted_r << ' ' << item.weighted_f;
+        << ' ' << item.weighted_r << ' ' << item.weighted_f << ' ' << item.coco_map << ' '
+        << item.coco_map_50 << ' ' << item.coco_map_75 << ' ' << item.coco_map_small << ' '
+        << item.coco_map_medium << ' ' << item.coco_map_large;
     return out;
 }
 
@@ -1,95 +1,563 @@
 #include "model.h"
 
+#include "flat_weights.h"
 #include "model_impl.h"
 
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 using namespace dlib;
 
+namespace
+{
+    template <typename... NETS, typename... ARGS>
+    auto emplace_network(std::variant<NETS...>& net, const std::string& name, const ARGS&... args)
+        -> bool
+    {
+        return ((name == NETS::name and (net.template emplace<NETS>(args...), true)) or ...);
+    }
+
+    template <typename... NETS>
+    auto get_network_names(const std::variant<NETS...>*) -> std::vector<std::string>
+    {
+        return {NETS::name...};
+    }
+
+    auto is_architecture(const std::string& name) -> bool
+    {
+        const auto names = model::get_architectures();
+        return std::find(names.begin(), names.end(), name) != names.end();
+    }
+
+    // The networks are serialized after their architecture name.  Files without it were saved
+    // before the architecture could be selected at runtime, and they always hold a yolov7.
+    auto read_architecture(std::istream& in) -> std::string
+    {
+        std::string name;
+        try
+        {
+            deserialize(name, in);
+        }
+        catch (const serialization_error&)
+        {
+        }
+        if (is_architecture(name))
+            return name;
+        in.clear();
+        in.seekg(0);
+        return yolov7_net::name;
+    }
+
+    // The quantized inference networks are saved after the name of their precision, following
+    // the architecture.
+    auto get_precision_name(const inference_precision precision) -> std::string
+    {
+        switch (precision)
+        {
+        case inference_precision::bf16:
+            return "bf16";
+        case inference_precision::int8:
+            return "int8";
+        case inference_precision::fp32_packed:
+            return "fp32-packed";
+        default:
+            return "fp32";
+        }
+    }
+
+    auto read_precision(std::istream& in) -> inference_precision
+    {
+        const auto pos = in.tellg();
+        std::string name;
+        try
+        {
+            deserialize(name, in);
+        }
+        catch (const serialization_error&)
+        {
+        }
+        for (const auto precision :
+             {inference_precision::bf16,
+              inference_precision::int8,
+              inference_precision::fp32_packed})
+        {
+            if (name == get_precision_name(precision))
+                return precision;
+        }
+        in.clear();
+        in.seekg(pos);
+        return inference_precision::fp32;
+    }
+
+    template <typename NET> void write_network(
+        std::ostream& out,
+        const std::string& name,
+        const inference_precision precision,
+        const NET& net)
+    {
+        serialize(name, out);
+        if (precision != inference_precision::fp32)
+            serialize(get_precision_name(precision), out);
+        serialize(net, out);
+    }
+
+    // Moves the parameters of a layer to the writer, leaving the layer empty for the skeleton of
+    // a mappable file.
+    template <typename LAYER> void store_parameters(LAYER& l, flat_weights_writer& writer)
+    {
+        auto& params = dynamic_cast<resizable_tensor&>(l.get_layer_params());
+        writer.add(
+            params.host(),
+            params.size() * sizeof(float),
+            {params.num_samples(), params.k(), params.nr(), params.nc()});
+        params.clear();
+    }
+
+    template <long NF, long NR, long NC, int SY, int SX, int PY, int PX>
+    void store_parameters(qcon_<NF, NR, NC, SY, SX, PY, PX>& l, flat_weights_writer& writer)
+    {
+        const auto [data, size] = l.get_weights();
+        writer.add(data, size);
+        l.set_weights(nullptr, 0);
+    }
+
+    // The dlib tensors own their memory, so their parameters are copied from the mapped file,
+    // while the quantized layers use theirs in place.
+    template <typename LAYER> void load_parameters(
+        LAYER& l,
+        const flat_weights& weights,
+        const flat_array& array)
+    {
+        auto& params = dynamic_cast<resizable_tensor&>(l.get_layer_params());
+        params.set_size(array.shape[0], array.shape[1], array.shape[2], array.shape[3]);
+        if (params.size() * sizeof(float) != array.size)
+            throw serialization_error("ERROR: wrong size of parameters in the mapped file");
+        if (array.size > 0)
+            std::memcpy(params.host(), weights.get_data(array), array.size);
+    }
+
+    template <long NF, long NR, long NC, int SY, int SX, int PY, int PX>
+    void load_parameters(
+        qcon_<NF, NR, NC, SY, SX, PY, PX>& l,
+        const flat_weights& weights,
+        const flat_array& array)
+    {
+        l.set_weights(weights.get_data(array), array.size);
+    }
+
+    template <typename NET> void load_network_parameters(NET& net, const flat_weights& weights)
+    {
+        const auto& table = weights.get_table();
+        size_t i = 0;
+        visit_computational_layers(
+            net,
+            [&](auto& l)
+            {
+                if (i == table.size())
+                    throw serialization_error("ERROR: missing parameters in the mapped file");
+                load_parameters(l, weights, table[i++]);
+            });
+        if (i != table.size())
+            throw serialization_error("ERROR: too many parameters in the mapped file");
+    }
+
+    auto open_network(const std::string& path) -> std::ifstream
+    {
+        std::ifstream fin(path, std::ios::binary);
+        if (not fin.good())
+            throw serialization_error("Unable to open " + path + " for reading.");
+        return fin;
+    }
+
+    // Appends the indices of the values above the threshold, 8 at a time with AVX2.
+    void find_candidates(
+        const float* values,
+        const long size,
+        const float threshold,
+        std::vector<long>& indices)
+    {
+        long i = 0;
+#if defined(__AVX2__)
+        const __m256 t = _mm256_set1_ps(threshold);
+        for (; i + 8 <= size; i += 8)
+        {
+            const auto mask = _mm256_cmp_ps(_mm256_loadu_ps(values + i), t, _CMP_GT_OQ);
+            for (int bits = _mm256_movemask_ps(mask); bits != 0; bits &= bits - 1)
+                indices.push_back(i + __builtin_ctz(bits));
+        }
+#endif
+        for (; i < size; ++i)
+        {
+            if (values[i] > threshold)
+                indices.push_back(i);
+        }
+    }
+
+    // Where the class scores of a decoded detection are, to fill its labels later on.
+    struct class_scores
+    {
+        const float* data;
+        long plane_size;
+        float obj;
+    };
+
+    // Decodes the detections of one sample like loss_yolo does, but it only sets the best label
+    // of each detection.  Most cells have a low objectness, so the objectness planes are scanned
+    // first, and only the cells above the threshold get their box and classes decoded.
+    template <template <typename> class TAG, typename NET> void decode_detections(
+        const tensor& input,
+        NET& net,
+        const long n,
+        const float conf,
+        std::vector<long>& candidates,
+        std::vector<yolo_rect>& detections,
+        std::vector<class_scores>& scores)
+    {
+        const auto& options = net.loss_details().get_options();
+        const auto& anchors = options.anchors.at(tag_id<TAG>::id);
+        const tensor& output = layer<TAG>(net).get_output();
+        const auto stride_x = static_cast<double>(input.nc()) / output.nc();
+        const auto stride_y = static_cast<double>(input.nr()) / output.nr();
+        const long num_feats = output.k() / anchors.size();
+        const long num_classes = num_feats - 5;
+        const long plane_size = output.nr() * output.nc();
+        const float* const out_data = output.host() + n * output.k() * plane_size;
+        for (size_t a = 0; a < anchors.size(); ++a)
+        {
+            const float* const feats = out_data + a * num_feats * plane_size;
+            candidates.clear();
+            find_candidates(feats + 4 * plane_size, plane_size, conf, candidates);
+            for (const auto i : candidates)
+            {
+                const float obj = feats[4 * plane_size + i];
+                const float* const classes = feats + 5 * plane_size + i;
+                long best = 0;
+                for (long l = 1; l < num_classes; ++l)
+                {
+                    const float score = classes[l * plane_size];
+                    const float best_score = classes[best * plane_size];
+                    // the labels with the same score are sorted by name in loss_yolo
+                    if (score > best_score or
+                        (score == best_score and options.labels[l] > options.labels[best]))
+                        best = l;
+                }
+                const float confidence = obj * classes[best * plane_size];
+                if (confidence <= conf)
+                    continue;
+                const long r = i / output.nc();
+                const long c = i % output.nc();
+                const auto x = feats[0 * plane_size + i] * 2.0 - 0.5;
+                const auto y = feats[1 * plane_size + i] * 2.0 - 0.5;
+                const auto w = feats[2 * plane_size + i];
+                const auto h = feats[3 * plane_size + i];
+                // a saturated sigmoid would give an infinite box, which the NMS cannot bin
+                if (not(w < 1 and h < 1 and std::isfinite(x) and std::isfinite(y)))
+                    continue;
+                yolo_rect det(centered_drect(
+                    dpoint((x + c) * stride_x, (y + r) * stride_y),
+                    w / (1 - w) * anchors[a].width,
+                    h / (1 - h) * anchors[a].height));
+                det.detection_confidence = confidence;
+                det.label = options.labels[best];
+                detections.push_back(std::move(det));
+                scores.push_back({classes, plane_size, obj});
+            }
+        }
+    }
+
+    // Fills all the labels above the threshold, sorted by decreasing score
+    void fill_labels(
+        yolo_rect& det,
+        const class_scores& scores,
+        const std::vector<std::string>& labels,
+        const float conf)
+    {
+        for (size_t l = 0; l < labels.size(); ++l)
+        {
+            const float score = scores.obj * scores.data[l * scores.plane_size];
+            if (score > conf)
+                det.labels.emplace_back(score, labels[l]);
+        }
+        std::sort(det.labels.rbegin(), det.labels.rend());
+    }
+}  // namespace
+
+model::impl::impl(const std::string& architecture)
+{
+    if (not emplace_network(net, architecture))
+        throw std::runtime_error("ERROR: unknown architecture " + architecture);
+}
+
+model::impl::impl(const yolo_options& options, const std::string& architecture)
+{
+    if (not emplace_network(net, architecture, options))
+        throw std::runtime_error("ERROR: unknown architecture " + architecture);
+}
+
 model::~model() = default;
 
 model::model() : pimpl(std::make_unique<model::impl>())
 {
 }
 
-model::model(const yolo_options& options) : pimpl(std::make_unique<model::impl>(options))
+model::model(const std::string& architecture)
+    : pimpl(std::make_unique<model::impl>(architecture))
 {
-    auto& net = pimpl->train;
-    using namespace dlib;
-    // setup the leaky relu activations
-    visit_computational_layers(net, [](leaky_relu_& l) { l = leaky_relu_(0.1); });
-    disable_duplicative_biases(net);
-    // set the number of filters in the convolutions for YOLO layers
-    const long num_classes = options.labels.size();
-    const long num_anchors_p3 = options.anchors.at(tag_id<ytag3>::id).size();
-    const long num_anchors_p4 = options.anchors.at(tag_id<ytag4>::id).size();
-    const long num_anchors_p5 = options.anchors.at(tag_id<ytag5>::id).size();
-    layer<ytag3, 2>(net).layer_details().set_num_filters(num_anchors_p3 * (num_classes + 5));
-    layer<ytag4, 2>(net).layer_details().set_num_filters(num_anchors_p4 * (num_classes + 5));
-    layer<ytag5, 2>(net).layer_details().set_num_filters(num_anchors_p5 * (num_classes + 5));
-    // increase the batch normalization window size
-    set_all_bn_running_stats_window_sizes(net, 1000);
+}
+
+model::model(const yolo_options& options, const std::string& architecture)
+    : pimpl(std::make_unique<model::impl>(options, architecture))
+{
+    std::visit(
+        [&options](auto& n)
+        {
+            auto& net = n.train;
+            // setup the leaky relu activations
+            visit_computational_layers(net, [](leaky_relu_& l) { l = leaky_relu_(0.1); });
+            disable_duplicative_biases(net);
+            // set the number of filters in the convolutions for YOLO layers
+            const long num_classes = options.labels.size();
+            const long num_anchors_p3 = options.anchors.at(tag_id<ytag3>::id).size();
+            const long num_anchors_p4 = options.anchors.at(tag_id<ytag4>::id).size();
+            const long num_anchors_p5 = options.anchors.at(tag_id<ytag5>::id).size();
+            layer<ytag3, 2>(net).layer_details().set_num_filters(
+                num_anchors_p3 * (num_classes + 5));
+            layer<ytag4, 2>(net).layer_details().set_num_filters(
+                num_anchors_p4 * (num_classes + 5));
+            layer<ytag5, 2>(net).layer_details().set_num_filters(
+                num_anchors_p5 * (num_classes + 5));
+            // increase the batch normalization window size
+            set_all_bn_running_stats_window_sizes(net, 1000);
+        },
+        pimpl->net);
+}
+
+model::model(const model& other) : pimpl(std::make_unique<model::impl>(*other.pimpl))
+{
+}
+
+auto model::operator=(const model& other) -> model&
+{
+    if (this != &other)
+        *pimpl = *other.pimpl;
+    return *this;
 }
 
 void model::setup(const yolo_options& options)
 {
-    pimpl->train.loss_details() = loss_yolo_<yolov7::ytag3, yolov7::ytag4, yolov7::ytag5>(options);
+    std::visit(
+        [&options](auto& net)
+        {
+            using loss_type = typename std::decay_t<decltype(net.train)>::loss_details_type;
+            net.train.loss_details() = loss_type(options);
+        },
+        pimpl->net);
     sync();
 }
 
 void model::sync()
 {
-    pimpl->infer = pimpl->train;
+    std::visit([](auto& net) { net.infer = net.train; }, pimpl->net);
+    pimpl->calibrating = false;
+    pimpl->precision = inference_precision::fp32;
 }
 
 void model::clean()
 {
-    pimpl->train.clean();
-    pimpl->infer.clean();
+    std::visit(
+        [](auto& net)
+        {
+            net.train.clean();
+            net.infer.clean();
+            net.quant.clean();
+        },
+        pimpl->net);
 }
 
 void model::save_train(const std::string& path)
 {
-    pimpl->train.clean();
-    serialize(path) << pimpl->train;
+    std::visit(
+        [&path](auto& net)
+        {
+            net.train.clean();
+            serialize(path) << std::string(net.name) << net.train;
+        },
+        pimpl->net);
 }
 
 void model::load_train(const std::string& path)
 {
-    deserialize(path) >> pimpl->train;
+    auto fin = open_network(path);
+    const auto architecture = read_architecture(fin);
+    if (architecture != get_architecture())
+    {
+        const auto nms = pimpl->nms;
+        pimpl = std::make_unique<model::impl>(architecture);
+        pimpl->nms = nms;
+    }
+    std::visit([&fin](auto& net) { deserialize(net.train, fin); }, pimpl->net);
+}
+
+void model::save_infer(const std::string& path, const bool mappable)
+{
+    if (mappable)
+    {
+        flat_weights_writer writer;
+        const auto skeleton = get_skeleton(writer);
+        writer.save(path, skeleton);
+        return;
+    }
+    std::visit(
+        [&](auto& n)
+        {
+            const auto save = [&](auto& net)
+            {
+                net.clean();
+                std::ofstream fout(path, std::ios::binary);
+                if (not fout.good())
+                    throw serialization_error("Unable to open " + path + " for writing.");
+                write_network(fout, n.name, pimpl->precision, net);
+            };
+            if (pimpl->is_quantized())
+                save(n.quant);
+            else
+                save(n.infer);
+        },
+        pimpl->net);
+}
+
+auto model::save_shared(const std::string& name) -> uint64_t
+{
+    flat_weights_writer writer;
+    const auto skeleton = get_skeleton(writer);
+    return writer.publish(name, skeleton);
 }
 
-void model::save_infer(const std::string& path)
+auto model::get_skeleton(flat_weights_writer& writer) -> std::string
 {
-    pimpl->infer.clean();
-    serialize(path) << pimpl->infer;
+    std::ostringstream sout;
+    std::visit(
+        [&](auto& n)
+        {
+            // the skeleton is a copy of the network without its parameters
+            const auto write = [&](auto skeleton, const inference_precision precision)
+            {
+                visit_computational_layers(
+                    skeleton,
+                    [&writer](auto& l) { store_parameters(l, writer); });
+                write_network(sout, n.name, precision, skeleton);
+            };
+            if (pimpl->is_quantized())
+            {
+                n.quant.clean();
+                write(n.quant, pimpl->precision);
+                return;
+            }
+            // the dlib tensors would be copied by each process, so the convolutions are packed
+            n.infer.clean();
+            typename std::decay_t<decltype(n)>::quant_type packed;
+            packed = n.infer;
+            visit_computational_layers(packed, [](auto& l) { convert_to_fp32(l); });
+            write(std::move(packed), inference_precision::fp32_packed);
+        },
+        pimpl->net);
+    return sout.str();
 }
 
 void model::load_infer(const std::string& path)
 {
-    deserialize(path) >> pimpl->infer;
+    // the mappable files only hold the skeleton of the network to deserialize
+    if (flat_weights::is_flat_weights(path))
+    {
+        const auto weights = std::make_shared<const flat_weights>(path);
+        std::istringstream sin(weights->get_skeleton());
+        load_infer(sin, weights);
+    }
+    else
+    {
+        auto fin = open_network(path);
+        load_infer(fin, nullptr);
+    }
+}
+
+void model::load_shared(const std::string& name, const uint64_t version)
+{
+    const auto weights = flat_weights::attach(name, version);
+    std::istringstream sin(weights->get_skeleton());
+    load_infer(sin, weights);
+}
+
+void model::load_infer(std::istream& in, const std::shared_ptr<const flat_weights>& weights)
+{
+    const auto architecture = read_architecture(in);
+    if (architecture != get_architecture())
+    {
+        const auto nms = pimpl->nms;
+        pimpl = std::make_unique<model::impl>(architecture);
+        pimpl->nms = nms;
+    }
+    pimpl->calibrating = false;
+    pimpl->precision = read_precision(in);
+    std::visit(
+        [&](auto& n)
+        {
+            const auto load = [&](auto& net)
+            {
+                deserialize(net, in);
+                if (weights)
+                    load_network_parameters(net, *weights);
+            };
+            if (pimpl->is_quantized())
+                load(n.quant);
+            else
+                load(n.infer);
+        },
+        pimpl->net);
+    pimpl->mapped_weights = weights;
 }
 
 void model::load_backbone(const std::string& path)
 {
-    net_train_type temp;
-    deserialize(path) >> temp;
-    layer<ytag3, 3>(pimpl->train) = layer<ytag3, 3>(temp);
+    auto fin = open_network(path);
+    const auto architecture = read_architecture(fin);
+    if (architecture != get_architecture())
+        throw std::runtime_error(
+            "ERROR: the backbone is a " + architecture + " but the model is a " +
+            get_architecture());
+    std::visit(
+        [&fin](auto& net)
+        {
+            typename std::decay_t<decltype(net)>::train_type temp;
+            deserialize(temp, fin);
+            layer<ytag3, 3>(net.train) = layer<ytag3, 3>(temp);
+        },
+        pimpl->net);
     sync();
 }
 
 auto model::get_strides(const long image_size) -> std::vector<long>
 {
     matrix<rgb_pixel> image(image_size, image_size);
-    auto& net = pimpl->infer;
-    net(image);
-    const auto& t3 = layer<ytag3>(net).get_output();
-    const auto& t4 = layer<ytag4>(net).get_output();
-    const auto& t5 = layer<ytag5>(net).get_output();
-    return {image_size / t3.nr(), image_size / t4.nc(), image_size / t5.nr()};
+    return pimpl->visit_inference(
+        [&image, image_size](auto& net) -> std::vector<long>
+        {
+            net(image);
+            const auto& t3 = layer<ytag3>(net).get_output();
+            const auto& t4 = layer<ytag4>(net).get_output();
+            const auto& t5 = layer<ytag5>(net).get_output();
+            return {image_size / t3.nr(), image_size / t4.nc(), image_size / t5.nr()};
+        });
 }
 
 auto model::operator()(const matrix<rgb_pixel>& image, const float conf) -> std::vector<yolo_rect>
 {
-    return pimpl->infer.process(image, conf);
+    resizable_tensor input;
+    pimpl->visit_inference([&](auto& net) { net.to_tensor(&image, &image + 1, input); });
+    return std::move((*this)(input, conf).front());
 }
 
 auto model::operator()(
@@ -97,36 +565,173 @@ auto model::operator()(
     const size_t batch_size,
     const float conf) -> std::vector<std::vector<yolo_rect>>
 {
-    return pimpl->infer.process_batch(images, batch_size, conf);
+    std::vector<std::vector<yolo_rect>> detections;
+    detections.reserve(images.size());
+    resizable_tensor input;
+    for (size_t begin = 0; begin < images.size(); begin += batch_size)
+    {
+        const auto end = images.begin() + std::min(begin + batch_size, images.size());
+        pimpl->visit_inference([&](auto& net)
+                               { net.to_tensor(images.begin() + begin, end, input); });
+        for (auto& dets : (*this)(input, conf))
+            detections.push_back(std::move(dets));
+    }
+    return detections;
 }
 
-void model::adjust_nms(const float iou_threshold, const float ratio_covered, const bool classwise)
+auto model::operator()(const tensor& input, const float conf)
+    -> std::vector<std::vector<yolo_rect>>
 {
-    pimpl->train.loss_details().adjust_nms(iou_threshold, ratio_covered, classwise);
-    pimpl->infer.loss_details().adjust_nms(iou_threshold, ratio_covered, classwise);
+    std::vector<std::vector<yolo_rect>> detections(input.num_samples());
+    pimpl->visit_inference(
+        [&](auto& net)
+        {
+            net.subnet().forward(input);
+            const auto& options = net.loss_details().get_options();
+            std::vector<long> candidates;
+            std::vector<yolo_rect> dets;
+            std::vector<class_scores> scores;
+            for (long i = 0; i < input.num_samples(); ++i)
+            {
+                dets.clear();
+                scores.clear();
+                decode_detections<ytag3>(input, net, i, conf, candidates, dets, scores);
+                decode_detections<ytag4>(input, net, i, conf, candidates, dets, scores);
+                decode_detections<ytag5>(input, net, i, conf, candidates, dets, scores);
+                // the labels of the suppressed detections are never needed, so they are only
+                // filled for the kept ones
+                const auto kept = non_max_suppression_indices(
+                    dets,
+                    options.overlaps_nms,
+                    options.classwise_nms,
+                    pimpl->nms);
+                detections[i].reserve(kept.size());
+                for (const auto k : kept)
+                {
+                    fill_labels(dets[k], scores[k], options.labels, conf);
+                    detections[i].push_back(std::move(dets[k]));
+                }
+            }
+        });
+    return detections;
+}
+
+void model::adjust_nms(
+    const float iou_threshold,
+    const float ratio_covered,
+    const bool classwise,
+    const nms_algorithm algorithm)
+{
+    pimpl->nms = algorithm;
+    std::visit(
+        [=](auto& net)
+        {
+            net.train.loss_details().adjust_nms(iou_threshold, ratio_covered, classwise);
+            net.infer.loss_details().adjust_nms(iou_threshold, ratio_covered, classwise);
+            net.quant.loss_details().adjust_nms(iou_threshold, ratio_covered, classwise);
+        },
+        pimpl->net);
 }
 
 void model::fuse()
 {
-    fuse_layers(pimpl->infer);
+    // the quantized networks are converted from fused ones
+    if (pimpl->is_quantized())
+        return;
+    std::visit([](auto& net) { fuse_layers(net.infer); }, pimpl->net);
+}
+
+void model::calibrate(const std::vector<matrix<rgb_pixel>>& images)
+{
+    if (pimpl->is_quantized())
+        throw std::runtime_error("ERROR: the convolutions of the network are already converted");
+    std::visit(
+        [&](auto& net)
+        {
+            if (not pimpl->calibrating)
+                net.quant = net.infer;
+            resizable_tensor input;
+            net.quant.to_tensor(images.begin(), images.end(), input);
+            net.quant.subnet().forward(input);
+        },
+        pimpl->net);
+    pimpl->calibrating = true;
+}
+
+void model::quantize(const inference_precision precision)
+{
+    if (pimpl->is_quantized())
+        throw std::runtime_error("ERROR: the convolutions of the network are already converted");
+    if (precision == inference_precision::fp32)
+        return;
+    if (precision == inference_precision::int8 and not pimpl->calibrating)
+        throw std::runtime_error("ERROR: the network must be calibrated before quantization");
+    std::visit(
+        [&](auto& net)
+        {
+            if (not pimpl->calibrating)
+                net.quant = net.infer;
+            if (precision == inference_precision::int8)
+                visit_computational_layers(net.quant, [](auto& l) { finish_calibration(l); });
+            else if (precision == inference_precision::bf16)
+                visit_computational_layers(net.quant, [](auto& l) { convert_to_bf16(l); });
+            else
+                visit_computational_layers(net.quant, [](auto& l) { convert_to_fp32(l); });
+            net.quant.clean();
+        },
+        pimpl->net);
+    pimpl->calibrating = false;
+    pimpl->precision = precision;
+}
+
+auto model::get_precision() const -> inference_precision
+{
+    return pimpl->precision;
 }
 
 const yolo_options& model::get_options() const
 {
-    return pimpl->infer.loss_details().get_options();
+    return pimpl->visit_inference([](const auto& net) -> const yolo_options&
+                                  { return net.loss_details().get_options(); });
+}
+
+auto model::get_input_means() const -> std::array<float, 3>
+{
+    return pimpl->visit_inference(
+        [](const auto& net) -> std::array<float, 3>
+        {
+            const auto& input = net.input_layer();
+            return {input.get_avg_red(), input.get_avg_green(), input.get_avg_blue()};
+        });
+}
+
+auto model::get_architecture() const -> std::string
+{
+    return std::visit([](const auto& net) -> std::string { return net.name; }, pimpl->net);
+}
+
+auto model::get_architectures() -> std::vector<std::string>
+{
+    return get_network_names(static_cast<const networks*>(nullptr));
 }
 
 void model::print(std::ostream& out) const
 {
-    out << pimpl->train << '\n';
+    std::visit([&out](const auto& net) { out << net.train << '\n'; }, pimpl->net);
 }
 
 void model::print_loss_details(std::ostream& out) const
 {
-    out << "num parameters: " << count_parameters(pimpl->infer) << '\n';
-    out << "num layers: " << pimpl->infer.num_layers
-        << " (computational: " << pimpl->infer.num_computational_layers << ")\n";
-    const auto& opts = pimpl->infer.loss_details().get_options();
+    out << "architecture: " << get_architecture() << " (" << get_precision_name(pimpl->precision)
+        << ")\n";
+    pimpl->visit_inference(
+        [&out](const auto& net)
+        {
+            out << "num parameters: " << count_parameters(net) << '\n';
+            out << "num layers: " << net.num_layers
+                << " (computational: " << net.num_computational_layers << ")\n";
+        });
+    const auto& opts = get_options();
     out << "YOLO loss details (" << opts.anchors.size() << " outputs)" << '\n';
     out << "  anchors:\n";
     for (const auto& [tag_id, anchors] : opts.anchors)
@@ -1,18 +1,38 @@
 #ifndef model_h_INCLUDED
 #define model_h_INCLUDED
 
+#include "nms.h"
+
 #include <dlib/dnn.h>
 
+class flat_weights;
+class flat_weights_writer;
+
 template <typename SUBNET> using ytag3 = dlib::add_tag_layer<4003, SUBNET>;
 template <typename SUBNET> using ytag4 = dlib::add_tag_layer<4004, SUBNET>;
 template <typename SUBNET> using ytag5 = dlib::add_tag_layer<4005, SUBNET>;
 
+// How the convolutions of the inference network store their weights
+enum class inference_precision
+{
+    // the dlib convolutions
+    fp32,
+    bf16,
+    int8,
+    // single precision, packed like bf16, so that the weights can be used in place when mapped
+    fp32_packed,
+};
+
 class model
 {
     public:
     model();
     ~model();
-    model(const dlib::yolo_options& options);
+    explicit model(const std::string& architecture);
+    model(const dlib::yolo_options& options, const std::string& architecture = "yolov7");
+    // deep copies of the networks, e.g. to evaluate a snapshot while the original one trains
+    model(const model& other);
+    auto operator=(const model& other) -> model&;
     auto operator()(const dlib::matrix<dlib::rgb_pixel>& image, const float conf = 0.25)
         -> std::vector<dlib::yolo_rect>;
 
@@ -21,25 +41,53 @@ class model
         const size_t batch_size,
         const float conf = 0.25) -> std::vector<std::vector<dlib::yolo_rect>>;
 
+    // runs the network on a tensor that is already in the format of the input layer
+    auto operator()(const dlib::tensor& input, const float conf = 0.25)
+        -> std::vector<std::vector<dlib::yolo_rect>>;
+
     void setup(const dlib::yolo_options& options);
     void sync();
     void clean();
     void save_train(const std::string& path);
     void load_train(const std::string& path);
-    void save_infer(const std::string& path);
+    // The mappable files hold the parameters as raw arrays, which load faster and which the
+    // converted convolutions use in place, sharing the pages between the processes.  The fp32
+    // convolutions are saved as fp32_packed for that.
+    void save_infer(const std::string& path, const bool mappable = false);
     void load_infer(const std::string& path);
+    // The same content as the mappable files, published in POSIX shared memory under a name that
+    // starts with a slash, for the detectors of a host to share one copy of the weights of the
+    // convolutions.  Publishing again under the same name gives the next version, and the
+    // models loaded from the previous one keep it.  The version 0 loads the current one.
+    auto save_shared(const std::string& name) -> uint64_t;
+    void load_shared(const std::string& name, const uint64_t version = 0);
     void load_backbone(const std::string& path);
     auto get_strides(const long image_size = 512) -> std::vector<long>;
     const dlib::yolo_options& get_options() const;
+    auto get_input_means() const -> std::array<float, 3>;
+    auto get_architecture() const -> std::string;
+    static auto get_architectures() -> std::vector<std::string>;
     void adjust_nms(
         const float iou_threshold,
         const float ratio_covered = 1,
-        const bool classwise = true);
+        const bool classwise = true,
+        const nms_algorithm algorithm = nms_algorithm::linear);
     void fuse();
+    // Post-training quantization of the inference network: calibrate() runs batches of images
+    // through a copy of it to record the ranges of the convolution inputs, and quantize() then
+    // converts that copy to the given precision and makes it run the inference.  Only int8 needs
+    // the calibration.  Once converted, the network can not be converted again.
+    void calibrate(const std::vector<dlib::matrix<dlib::rgb_pixel>>& images);
+    void quantize(const inference_precision precision = inference_precision::int8);
+    auto get_precision() const -> inference_precision;
     void print(std::ostream& out) const;
     void print_loss_details(std::ostream& out = std::cout) const;
 
     private:
+    // moves the parameters of a copy of the inference network to the writer, and returns the
+    // serialized copy
+    auto get_skeleton(flat_weights_writer& writer) -> std::string;
+    void load_infer(std::istream& in, const std::shared_ptr<const flat_weights>& weights);
     struct impl;
     std::unique_ptr<impl> pimpl;
     friend class sgd_trainer;
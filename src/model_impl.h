@@ -1,17 +1,111 @@
 #ifndef model_impl_h_INCLUDED
 #define model_impl_h_INCLUDED
 #include "model.h"
+#include "yolov5.h"
 #include "yolov7.h"
+#include "yolov7_tiny.h"
 
-using net_train_type = yolov7::train_type;
-using net_infer_type = yolov7::infer_type;
+#include <memory>
+#include <variant>
+
+class flat_weights;
+
+template <typename TRAIN, typename INFER, typename QUANT> struct network
+{
+    using train_type = TRAIN;
+    using infer_type = INFER;
+    using quant_type = QUANT;
+    network() = default;
+    network(const dlib::yolo_options& options) : train(options), infer(options) {}
+    train_type train;
+    infer_type infer;
+    // the inference network with reduced precision convolutions, converted from infer
+    quant_type quant;
+};
+
+// The names are stored in the serialized networks, so they must not be changed.
+struct yolov7_net : network<yolov7::train_type, yolov7::infer_type, yolov7::quant_type>
+{
+    static constexpr auto name = "yolov7";
+    using network::network;
+};
+
+struct yolov7_tiny_net
+    : network<yolov7_tiny::train_type, yolov7_tiny::infer_type, yolov7_tiny::quant_type>
+{
+    static constexpr auto name = "yolov7-tiny";
+    using network::network;
+};
+
+struct yolov5n_net : network<yolov5::train_type_n, yolov5::infer_type_n, yolov5::quant_type_n>
+{
+    static constexpr auto name = "yolov5n";
+    using network::network;
+};
+
+struct yolov5s_net : network<yolov5::train_type_s, yolov5::infer_type_s, yolov5::quant_type_s>
+{
+    static constexpr auto name = "yolov5s";
+    using network::network;
+};
+
+struct yolov5m_net : network<yolov5::train_type_m, yolov5::infer_type_m, yolov5::quant_type_m>
+{
+    static constexpr auto name = "yolov5m";
+    using network::network;
+};
+
+struct yolov5l_net : network<yolov5::train_type_l, yolov5::infer_type_l, yolov5::quant_type_l>
+{
+    static constexpr auto name = "yolov5l";
+    using network::network;
+};
+
+struct yolov5x_net : network<yolov5::train_type_x, yolov5::infer_type_x, yolov5::quant_type_x>
+{
+    static constexpr auto name = "yolov5x";
+    using network::network;
+};
+
+// All the architectures that can be selected at runtime, the first one is the default.
+using networks = std::variant<
+    yolov7_net,
+    yolov7_tiny_net,
+    yolov5n_net,
+    yolov5s_net,
+    yolov5m_net,
+    yolov5l_net,
+    yolov5x_net>;
 
 struct model::impl
 {
     impl() = default;
-    impl(const dlib::yolo_options& options) : train(options), infer(options) {}
-    net_train_type train;
-    net_infer_type infer;
+    impl(const std::string& architecture);
+    impl(const dlib::yolo_options& options, const std::string& architecture);
+    networks net;
+    nms_algorithm nms = nms_algorithm::linear;
+    bool calibrating = false;
+    inference_precision precision = inference_precision::fp32;
+    // the file or shared memory the parameters were loaded from, if some layers use them in place
+    std::shared_ptr<const flat_weights> mapped_weights;
+
+    // calls f with the network that runs the inference: the quantized one if there is one
+    template <typename F> decltype(auto) visit_inference(F&& f)
+    {
+        return std::visit(
+            [&](auto& n) -> decltype(auto) { return is_quantized() ? f(n.quant) : f(n.infer); },
+            net);
+    }
+
+    template <typename F> decltype(auto) visit_inference(F&& f) const
+    {
+        return std::visit(
+            [&](const auto& n) -> decltype(auto)
+            { return is_quantized() ? f(n.quant) : f(n.infer); },
+            net);
+    }
+
+    bool is_quantized() const { return precision != inference_precision::fp32; }
 };
 
 #endif  // model_impl_h_INCLUDED
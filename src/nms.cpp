@@ -0,0 +1,246 @@
+#include "nms.h"
+
+#include <numeric>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+using namespace dlib;
+
+namespace
+{
+    // The kept boxes touching a cell of the grid, as a structure of arrays.  The label is an
+    // index into the labels seen in the detections, and index is the one of the detection.
+    struct grid_cell
+    {
+        std::vector<float> left, top, right, bottom;
+        std::vector<int> label;
+        std::vector<size_t> index;
+    };
+
+    struct box_geometry
+    {
+        float left, top, right, bottom;
+        int label;
+    };
+
+    // test_box_overlap works on rectangles with integer coordinates, and the detections are
+    // rounded before testing them.  Boxes that are less than one pixel apart may thus overlap,
+    // so the cheap test below keeps them, and the exact test is only run on those.
+    inline bool may_overlap(const grid_cell& cell, const size_t i, const box_geometry& g)
+    {
+        return std::min(cell.right[i], g.right) - std::max(cell.left[i], g.left) >= -1 and
+               std::min(cell.bottom[i], g.bottom) - std::max(cell.top[i], g.top) >= -1;
+    }
+
+    bool overlaps_any_kept(
+        const grid_cell& cell,
+        const box_geometry& g,
+        const yolo_rect& det,
+        const std::vector<yolo_rect>& detections,
+        const test_box_overlap& overlaps,
+        const bool classwise)
+    {
+        const size_t size = cell.index.size();
+        size_t i = 0;
+#if defined(__AVX2__)
+        const __m256 left = _mm256_set1_ps(g.left);
+        const __m256 top = _mm256_set1_ps(g.top);
+        const __m256 right = _mm256_set1_ps(g.right);
+        const __m256 bottom = _mm256_set1_ps(g.bottom);
+        const __m256 slack = _mm256_set1_ps(-1.f);
+        const __m256i label = _mm256_set1_epi32(g.label);
+        for (; i + 8 <= size; i += 8)
+        {
+            const __m256 iw = _mm256_sub_ps(
+                _mm256_min_ps(_mm256_loadu_ps(&cell.right[i]), right),
+                _mm256_max_ps(_mm256_loadu_ps(&cell.left[i]), left));
+            const __m256 ih = _mm256_sub_ps(
+                _mm256_min_ps(_mm256_loadu_ps(&cell.bottom[i]), bottom),
+                _mm256_max_ps(_mm256_loadu_ps(&cell.top[i]), top));
+            __m256 mask = _mm256_and_ps(
+                _mm256_cmp_ps(iw, slack, _CMP_GE_OQ),
+                _mm256_cmp_ps(ih, slack, _CMP_GE_OQ));
+            if (classwise)
+            {
+                const auto labels = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(&cell.label[i]));
+                mask = _mm256_and_ps(mask, _mm256_castsi256_ps(_mm256_cmpeq_epi32(labels, label)));
+            }
+            for (int bits = _mm256_movemask_ps(mask); bits != 0; bits &= bits - 1)
+            {
+                const auto j = i + __builtin_ctz(bits);
+                if (overlaps(detections[cell.index[j]].rect, det.rect))
+                    return true;
+            }
+        }
+#endif
+        for (; i < size; ++i)
+        {
+            if (classwise and cell.label[i] != g.label)
+                continue;
+            if (may_overlap(cell, i, g) and overlaps(detections[cell.index[i]].rect, det.rect))
+                return true;
+        }
+        return false;
+    }
+
+    auto linear_nms(
+        const std::vector<yolo_rect>& detections,
+        const std::vector<size_t>& order,
+        const test_box_overlap& overlaps,
+        const bool classwise) -> std::vector<size_t>
+    {
+        std::vector<size_t> kept;
+        for (const auto i : order)
+        {
+            const auto& det = detections[i];
+            bool suppressed = false;
+            for (const auto k : kept)
+            {
+                const auto& kept_det = detections[k];
+                if (overlaps(kept_det.rect, det.rect) and
+                    (not classwise or kept_det.label == det.label))
+                {
+                    suppressed = true;
+                    break;
+                }
+            }
+            if (not suppressed)
+                kept.push_back(i);
+        }
+        return kept;
+    }
+
+    auto grid_nms(
+        const std::vector<yolo_rect>& detections,
+        const std::vector<size_t>& order,
+        const test_box_overlap& overlaps,
+        const bool classwise) -> std::vector<size_t>
+    {
+        // without boxes, the bounds of the grid would stay infinite
+        if (order.empty())
+            return {};
+        std::unordered_map<std::string, int> label_ids;
+        std::vector<box_geometry> boxes;
+        boxes.reserve(detections.size());
+        float min_x = std::numeric_limits<float>::max();
+        float max_x = std::numeric_limits<float>::lowest();
+        float min_y = min_x, max_y = max_x;
+        double sum_sides = 0;
+        for (const auto i : order)
+        {
+            const auto& det = detections[i];
+            const auto id = label_ids.emplace(det.label, label_ids.size()).first->second;
+            const auto& r = det.rect;
+            boxes.push_back({
+                static_cast<float>(r.left()),
+                static_cast<float>(r.top()),
+                static_cast<float>(r.right()),
+                static_cast<float>(r.bottom()),
+                id});
+            min_x = std::min(min_x, boxes.back().left);
+            min_y = std::min(min_y, boxes.back().top);
+            max_x = std::max(max_x, boxes.back().right);
+            max_y = std::max(max_y, boxes.back().bottom);
+            sum_sides += std::max(r.width(), r.height());
+        }
+
+        // Cells about twice the average box size keep the number of cells per box low, and the
+        // grid is capped so that huge images with tiny boxes do not need a lot of memory.
+        constexpr float max_cells = 64;
+        min_x -= 1;
+        min_y -= 1;
+        max_x += 1;
+        max_y += 1;
+        const float cell_size = std::max(
+            {1.f,
+             static_cast<float>(2 * sum_sides / detections.size()),
+             (max_x - min_x) / max_cells,
+             (max_y - min_y) / max_cells});
+        const long grid_nc = static_cast<long>((max_x - min_x) / cell_size) + 1;
+        const long grid_nr = static_cast<long>((max_y - min_y) / cell_size) + 1;
+        const auto to_cell = [cell_size](const float v, const float origin, const long size)
+        { return std::clamp<long>(std::floor((v - origin) / cell_size), 0, size - 1); };
+
+        std::vector<grid_cell> grid(grid_nr * grid_nc);
+        std::vector<size_t> kept;
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            const auto& g = boxes[i];
+            const long c0 = to_cell(g.left - 1, min_x, grid_nc);
+            const long c1 = to_cell(g.right + 1, min_x, grid_nc);
+            const long r0 = to_cell(g.top - 1, min_y, grid_nr);
+            const long r1 = to_cell(g.bottom + 1, min_y, grid_nr);
+            bool suppressed = false;
+            for (long r = r0; r <= r1 and not suppressed; ++r)
+            {
+                for (long c = c0; c <= c1 and not suppressed; ++c)
+                {
+                    suppressed = overlaps_any_kept(
+                        grid[r * grid_nc + c],
+                        g,
+                        detections[order[i]],
+                        detections,
+                        overlaps,
+                        classwise);
+                }
+            }
+            if (suppressed)
+                continue;
+
+            for (long r = r0; r <= r1; ++r)
+            {
+                for (long c = c0; c <= c1; ++c)
+                {
+                    auto& cell = grid[r * grid_nc + c];
+                    cell.left.push_back(g.left);
+                    cell.top.push_back(g.top);
+                    cell.right.push_back(g.right);
+                    cell.bottom.push_back(g.bottom);
+                    cell.label.push_back(g.label);
+                    cell.index.push_back(order[i]);
+                }
+            }
+            kept.push_back(order[i]);
+        }
+        return kept;
+    }
+}  // namespace
+
+auto non_max_suppression_indices(
+    const std::vector<yolo_rect>& detections,
+    const test_box_overlap& overlaps,
+    const bool classwise,
+    const nms_algorithm algorithm) -> std::vector<size_t>
+{
+    std::vector<size_t> order(detections.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(
+        order.begin(),
+        order.end(),
+        [&detections](const size_t a, const size_t b)
+        { return detections[a].detection_confidence > detections[b].detection_confidence; });
+
+    switch (algorithm)
+    {
+    case nms_algorithm::linear:
+        return linear_nms(detections, order, overlaps, classwise);
+    case nms_algorithm::grid:
+        return grid_nms(detections, order, overlaps, classwise);
+    }
+    return order;
+}
+
+void non_max_suppression(
+    std::vector<yolo_rect>& detections,
+    const test_box_overlap& overlaps,
+    const bool classwise,
+    const nms_algorithm algorithm)
+{
+    std::vector<yolo_rect> kept;
+    for (const auto i : non_max_suppression_indices(detections, overlaps, classwise, algorithm))
+        kept.push_back(std::move(detections[i]));
+    detections = std::move(kept);
+}
@@ -0,0 +1,33 @@
+#ifndef nms_h_INCLUDED
+#define nms_h_INCLUDED
+
+#include <dlib/dnn.h>
+
+enum class nms_algorithm
+{
+    // the greedy scan done by dlib::loss_yolo, which compares each box to all the kept ones
+    linear,
+    // the same greedy suppression, but the kept boxes are binned in a uniform grid and only
+    // the ones sharing a cell are tested, several at a time with SIMD instructions
+    grid,
+};
+
+// Greedy non-maximum suppression: the detections are visited by decreasing confidence and kept
+// unless they overlap a box that was already kept (with the same label if classwise is true).
+// Both algorithms give the same boxes as loss_yolo, but on crowded scenes the cost of the grid
+// is close to linear in the number of detections instead of quadratic.
+void non_max_suppression(
+    std::vector<dlib::yolo_rect>& detections,
+    const dlib::test_box_overlap& overlaps,
+    const bool classwise = true,
+    const nms_algorithm algorithm = nms_algorithm::linear);
+
+// Same as above, but it returns the indices of the kept detections, by decreasing confidence.
+// Only the rect, detection_confidence and label of the detections are used.
+auto non_max_suppression_indices(
+    const std::vector<dlib::yolo_rect>& detections,
+    const dlib::test_box_overlap& overlaps,
+    const bool classwise = true,
+    const nms_algorithm algorithm = nms_algorithm::linear) -> std::vector<size_t>;
+
+#endif  // nms_h_INCLUDED
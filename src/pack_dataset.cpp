@@ -0,0 +1,67 @@
+#include "packed_dataset.h"
+
+#include <dlib/cmd_line_parser.h>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+using namespace dlib;
+
+auto main(const int argc, const char** argv) -> int
+try
+{
+    const auto num_threads = std::thread::hardware_concurrency();
+    const auto num_threads_str = std::to_string(num_threads);
+    command_line_parser parser;
+    parser.add_option("size", "image size used for training (default: 512)", 1);
+    parser.add_option("shard-size", "maximum size of the shards in MiB (default: 4096)", 1);
+    parser.add_option("output", "prefix of the shards (default: dataset path without .xml)", 1);
+    parser.add_option("threads", "number of loaders (default: " + num_threads_str + ")", 1);
+    parser.set_group_name("Help Options");
+    parser.add_option("h", "alias for --help");
+    parser.add_option("help", "display this message and exit");
+    parser.parse(argc, argv);
+
+    if (parser.number_of_arguments() == 0 or parser.option("h") or parser.option("help"))
+    {
+        std::cout << "Usage: " << argv[0] << " [OPTION]… PATH/TO/DATASET.xml…\n";
+        parser.print_options();
+        std::cout << "Packs the letterboxed images of the datasets into memory-mappable shards,\n";
+        std::cout << "which are read by train --packed.\n";
+        return EXIT_SUCCESS;
+    }
+    parser.check_option_arg_range<long>("size", 32, 8192);
+    parser.check_option_arg_range<long>("shard-size", 1, 1'000'000);
+    parser.check_option_arg_range<long>("threads", 1, 1024);
+    if (parser.option("output") and parser.number_of_arguments() > 1)
+        throw std::invalid_argument("ERROR: --output can only be used with one dataset");
+
+    const long image_size = get_option(parser, "size", 512);
+    const size_t shard_size = get_option(parser, "shard-size", 4096);
+    const size_t threads = get_option(parser, "threads", num_threads);
+
+    for (size_t i = 0; i < parser.number_of_arguments(); ++i)
+    {
+        const fs::path dataset_path(parser[i]);
+        auto prefix = dataset_path;
+        prefix.replace_extension();
+        image_dataset_metadata::dataset dataset;
+        image_dataset_metadata::load_image_dataset_metadata(dataset, dataset_path.string());
+        std::cout << "packing " << dataset.images.size() << " images of " << dataset_path.string()
+                  << '\n';
+        const auto num_errors = pack_dataset(
+            fs::absolute(dataset_path).parent_path().string(),
+            dataset,
+            get_option(parser, "output", prefix.string()),
+            image_size,
+            shard_size << 20,
+            threads);
+        if (num_errors > 0)
+            std::cerr << "WARNING: " << num_errors << " images could not be loaded\n";
+    }
+    return EXIT_SUCCESS;
+}
+catch (const std::exception& e)
+{
+    std::cerr << e.what() << '\n';
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,327 @@
+#include "packed_conv.h"
+
+#include <algorithm>
+#include <cstring>
+#include <dlib/serialize.h>
+#include <dlib/threads.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    // the output pixels processed together: two vectors of floats, so that the 8 accumulators
+    // of 4 filters stay in registers
+#if defined(__AVX512F__)
+    constexpr long pixel_block = 32;
+#else
+    constexpr long pixel_block = 16;
+#endif
+
+    // round to nearest even, the NaNs stay NaNs
+    inline auto to_bf16(const float value) -> uint16_t
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        if ((bits & 0x7fffffff) > 0x7f800000)
+            return (bits >> 16) | 0x40;
+        bits += 0x7fff + ((bits >> 16) & 1);
+        return bits >> 16;
+    }
+
+    inline auto to_float(const uint16_t value) -> float
+    {
+        const uint32_t bits = static_cast<uint32_t>(value) << 16;
+        float result;
+        std::memcpy(&result, &bits, sizeof(result));
+        return result;
+    }
+
+    inline auto to_float(const float value) -> float
+    {
+        return value;
+    }
+
+    inline auto pack_weight(const float value, uint16_t) -> uint16_t
+    {
+        return to_bf16(value);
+    }
+
+    inline auto pack_weight(const float value, float) -> float
+    {
+        return value;
+    }
+
+    template <typename T> auto get_version() -> std::string;
+    template <> auto get_version<uint16_t>() -> std::string
+    {
+        return "bf16_filters";
+    }
+    template <> auto get_version<float>() -> std::string
+    {
+        return "fp32_filters";
+    }
+
+    // The 4 x pixel_block products of a group of 4 filters with the columns of a block of
+    // pixels: out[j][p] = sum_i w[i][j] * x[i][p].
+    template <typename T> void dot4(const float* x, const T* w, const long size, float* out)
+    {
+#if defined(__AVX512F__)
+        __m512 a00 = _mm512_setzero_ps(), a01 = a00, a10 = a00, a11 = a00;
+        __m512 a20 = a00, a21 = a00, a30 = a00, a31 = a00;
+        for (long i = 0; i < size; ++i, x += pixel_block, w += 4)
+        {
+            const __m512 x0 = _mm512_loadu_ps(x);
+            const __m512 x1 = _mm512_loadu_ps(x + 16);
+            __m512 v = _mm512_set1_ps(to_float(w[0]));
+            a00 = _mm512_fmadd_ps(v, x0, a00);
+            a01 = _mm512_fmadd_ps(v, x1, a01);
+            v = _mm512_set1_ps(to_float(w[1]));
+            a10 = _mm512_fmadd_ps(v, x0, a10);
+            a11 = _mm512_fmadd_ps(v, x1, a11);
+            v = _mm512_set1_ps(to_float(w[2]));
+            a20 = _mm512_fmadd_ps(v, x0, a20);
+            a21 = _mm512_fmadd_ps(v, x1, a21);
+            v = _mm512_set1_ps(to_float(w[3]));
+            a30 = _mm512_fmadd_ps(v, x0, a30);
+            a31 = _mm512_fmadd_ps(v, x1, a31);
+        }
+        _mm512_storeu_ps(out, a00);
+        _mm512_storeu_ps(out + 16, a01);
+        _mm512_storeu_ps(out + pixel_block, a10);
+        _mm512_storeu_ps(out + pixel_block + 16, a11);
+        _mm512_storeu_ps(out + 2 * pixel_block, a20);
+        _mm512_storeu_ps(out + 2 * pixel_block + 16, a21);
+        _mm512_storeu_ps(out + 3 * pixel_block, a30);
+        _mm512_storeu_ps(out + 3 * pixel_block + 16, a31);
+#elif defined(__AVX2__) && defined(__FMA__)
+        __m256 a00 = _mm256_setzero_ps(), a01 = a00, a10 = a00, a11 = a00;
+        __m256 a20 = a00, a21 = a00, a30 = a00, a31 = a00;
+        for (long i = 0; i < size; ++i, x += pixel_block, w += 4)
+        {
+            const __m256 x0 = _mm256_loadu_ps(x);
+            const __m256 x1 = _mm256_loadu_ps(x + 8);
+            __m256 v = _mm256_set1_ps(to_float(w[0]));
+            a00 = _mm256_fmadd_ps(v, x0, a00);
+            a01 = _mm256_fmadd_ps(v, x1, a01);
+            v = _mm256_set1_ps(to_float(w[1]));
+            a10 = _mm256_fmadd_ps(v, x0, a10);
+            a11 = _mm256_fmadd_ps(v, x1, a11);
+            v = _mm256_set1_ps(to_float(w[2]));
+            a20 = _mm256_fmadd_ps(v, x0, a20);
+            a21 = _mm256_fmadd_ps(v, x1, a21);
+            v = _mm256_set1_ps(to_float(w[3]));
+            a30 = _mm256_fmadd_ps(v, x0, a30);
+            a31 = _mm256_fmadd_ps(v, x1, a31);
+        }
+        _mm256_storeu_ps(out, a00);
+        _mm256_storeu_ps(out + 8, a01);
+        _mm256_storeu_ps(out + pixel_block, a10);
+        _mm256_storeu_ps(out + pixel_block + 8, a11);
+        _mm256_storeu_ps(out + 2 * pixel_block, a20);
+        _mm256_storeu_ps(out + 2 * pixel_block + 8, a21);
+        _mm256_storeu_ps(out + 3 * pixel_block, a30);
+        _mm256_storeu_ps(out + 3 * pixel_block + 8, a31);
+#else
+        std::fill(out, out + 4 * pixel_block, 0.f);
+        for (long i = 0; i < size; ++i, x += pixel_block, w += 4)
+        {
+            for (long j = 0; j < 4; ++j)
+            {
+                const float v = to_float(w[j]);
+                for (long p = 0; p < pixel_block; ++p)
+                    out[j * pixel_block + p] += v * x[p];
+            }
+        }
+#endif
+    }
+}  // namespace
+
+template <typename T> void convert_filters(
+    const float* filters,
+    const float* biases,
+    const long num_filters,
+    const long k,
+    const long nr,
+    const long nc,
+    packed_filters<T>& output)
+{
+    const long filter_size = k * nr * nc;
+    const long num_groups = (num_filters + 3) / 4;
+    output.num_filters = num_filters;
+    output.k = k;
+    output.nr = nr;
+    output.nc = nc;
+    output.weights.assign(num_groups * filter_size * 4, 0);
+    output.biases.clear();
+    if (biases)
+        output.biases.assign(biases, biases + num_filters);
+    for (long f = 0; f < num_filters; ++f)
+    {
+        T* group = output.weights.data() + (f / 4) * filter_size * 4;
+        for (long i = 0; i < filter_size; ++i)
+            group[i * 4 + f % 4] = pack_weight(filters[f * filter_size + i], T());
+    }
+}
+
+template <typename T> void packed_conv(
+    const float* input,
+    const long num_samples,
+    const long nr,
+    const long nc,
+    const packed_filters<T>& filters,
+    const int stride_y,
+    const int stride_x,
+    const int padding_y,
+    const int padding_x,
+    float* output,
+    const long out_nr,
+    const long out_nc)
+{
+    const long k = filters.k;
+    const long filter_size = k * filters.nr * filters.nc;
+    const long plane_size = nr * nc;
+    const long out_plane_size = out_nr * out_nc;
+    const long blocks_per_sample = (out_plane_size + pixel_block - 1) / pixel_block;
+    dlib::parallel_for(
+        0,
+        num_samples * blocks_per_sample,
+        [&](const long b)
+        {
+            const long n = b / blocks_per_sample;
+            const long begin = (b % blocks_per_sample) * pixel_block;
+            const long count = std::min(pixel_block, out_plane_size - begin);
+            const float* sample = input + n * k * plane_size;
+
+            // gather the input windows of the pixels, one row per weight of the filters, and
+            // pad the rows of a partial block with zeros
+            long y0[pixel_block], x0[pixel_block];
+            for (long p = 0; p < count; ++p)
+            {
+                y0[p] = ((begin + p) / out_nc) * stride_y - padding_y;
+                x0[p] = ((begin + p) % out_nc) * stride_x - padding_x;
+            }
+            thread_local std::vector<float> columns;
+            columns.resize(filter_size * pixel_block);
+            float* col = columns.data();
+            for (long c = 0; c < k; ++c)
+            {
+                const float* plane = sample + c * plane_size;
+                for (long ky = 0; ky < filters.nr; ++ky)
+                {
+                    for (long kx = 0; kx < filters.nc; ++kx, col += pixel_block)
+                    {
+                        for (long p = 0; p < count; ++p)
+                        {
+                            const long y = y0[p] + ky;
+                            const long x = x0[p] + kx;
+                            const bool inside = y >= 0 and y < nr and x >= 0 and x < nc;
+                            col[p] = inside ? plane[y * nc + x] : 0;
+                        }
+                        std::fill(col + count, col + pixel_block, 0.f);
+                    }
+                }
+            }
+
+            float* out = output + n * filters.num_filters * out_plane_size + begin;
+            float acc[4 * pixel_block];
+            for (long f = 0; f < filters.num_filters; f += 4)
+            {
+                dot4(columns.data(), filters.weights.data() + f * filter_size, filter_size, acc);
+                const long num = std::min<long>(4, filters.num_filters - f);
+                for (long j = 0; j < num; ++j)
+                {
+                    const long o = f + j;
+                    const float bias = filters.biases.empty() ? 0 : filters.biases[o];
+                    for (long p = 0; p < count; ++p)
+                        out[o * out_plane_size + p] = acc[j * pixel_block + p] + bias;
+                }
+            }
+        });
+}
+
+template <typename T> void serialize(const packed_filters<T>& item, std::ostream& out)
+{
+    dlib::serialize(get_version<T>(), out);
+    dlib::serialize(item.num_filters, out);
+    dlib::serialize(item.k, out);
+    dlib::serialize(item.nr, out);
+    dlib::serialize(item.nc, out);
+    dlib::serialize(item.weights.size(), out);
+    // the weights are written as they are in memory, in the byte order of the host
+    out.write(
+        reinterpret_cast<const char*>(item.weights.data()),
+        item.weights.size() * sizeof(T));
+    dlib::serialize(item.biases, out);
+}
+
+template <typename T> void deserialize(packed_filters<T>& item, std::istream& in)
+{
+    std::string version;
+    dlib::deserialize(version, in);
+    if (version != get_version<T>())
+    {
+        throw dlib::serialization_error(
+            "Unexpected version found while deserializing " + get_version<T>());
+    }
+    dlib::deserialize(item.num_filters, in);
+    dlib::deserialize(item.k, in);
+    dlib::deserialize(item.nr, in);
+    dlib::deserialize(item.nc, in);
+    size_t size;
+    dlib::deserialize(size, in);
+    item.weights.resize(size);
+    in.read(reinterpret_cast<char*>(item.weights.data()), size * sizeof(T));
+    if (not in)
+        throw dlib::serialization_error("Error reading the weights of " + get_version<T>());
+    dlib::deserialize(item.biases, in);
+}
+
+// the two weight types
+template void convert_filters(
+    const float*,
+    const float*,
+    long,
+    long,
+    long,
+    long,
+    bf16_filters&);
+template void convert_filters(
+    const float*,
+    const float*,
+    long,
+    long,
+    long,
+    long,
+    fp32_filters&);
+template void packed_conv(
+    const float*,
+    long,
+    long,
+    long,
+    const bf16_filters&,
+    int,
+    int,
+    int,
+    int,
+    float*,
+    long,
+    long);
+template void packed_conv(
+    const float*,
+    long,
+    long,
+    long,
+    const fp32_filters&,
+    int,
+    int,
+    int,
+    int,
+    float*,
+    long,
+    long);
+template void serialize(const bf16_filters&, std::ostream&);
+template void serialize(const fp32_filters&, std::ostream&);
+template void deserialize(bf16_filters&, std::istream&);
+template void deserialize(fp32_filters&, std::istream&);
@@ -0,0 +1,64 @@
+#ifndef packed_conv_h_INCLUDED
+#define packed_conv_h_INCLUDED
+
+#include "weight_buffer.h"
+
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+// The filters of a convolution for the kernels below.  The filters are grouped by 4, and the
+// weights of a group are interleaved: the weight i of the 4 filters are consecutive.  The last
+// group is padded with zero filters.
+template <typename T> struct packed_filters
+{
+    long num_filters = 0;
+    long k = 0;
+    long nr = 0;
+    long nc = 0;
+    weight_buffer<T> weights;
+    // empty if the convolution has no bias
+    std::vector<float> biases;
+};
+
+// The weights stored as bfloat16, the upper half of a float, which halves the memory read
+using bf16_filters = packed_filters<uint16_t>;
+
+// The weights kept in single precision, in the same layout, so that they can also be used in
+// place from a mapped file
+using fp32_filters = packed_filters<float>;
+
+// Packs the num_filters x k x nr x nc filters of a dlib::con_, rounded to bfloat16 for
+// bf16_filters, and copies the optional biases.
+template <typename T> void convert_filters(
+    const float* filters,
+    const float* biases,
+    const long num_filters,
+    const long k,
+    const long nr,
+    const long nc,
+    packed_filters<T>& output);
+
+// Convolution of the num_samples x k x nr x nc input with the packed filters, written as
+// num_samples x num_filters x out_nr x out_nc floats.  The bfloat16 weights are widened to
+// floats as they are used, so the products and sums are always computed in single precision,
+// with AVX-512, AVX2 and FMA, or scalar code, depending on what the build enables.  The output
+// pixels are spread over the dlib threads.
+template <typename T> void packed_conv(
+    const float* input,
+    const long num_samples,
+    const long nr,
+    const long nc,
+    const packed_filters<T>& filters,
+    const int stride_y,
+    const int stride_x,
+    const int padding_y,
+    const int padding_x,
+    float* output,
+    const long out_nr,
+    const long out_nc);
+
+template <typename T> void serialize(const packed_filters<T>& item, std::ostream& out);
+template <typename T> void deserialize(packed_filters<T>& item, std::istream& in);
+
+#endif  // packed_conv_h_INCLUDED
@@ -0,0 +1,294 @@
+#include "packed_dataset.h"
+
+#include <cstring>
+#include <dlib/image_io.h>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+using namespace dlib;
+
+namespace
+{
+    // Each shard ends with the offset of its index and this magic string.
+    constexpr char pack_magic[] = "YOLOPACK";
+    constexpr size_t magic_size = sizeof(pack_magic) - 1;
+    constexpr size_t footer_size = sizeof(uint64_t) + magic_size;
+    const std::string pack_version = "packed_dataset_v1";
+    // the pixels of each image start at a multiple of this
+    constexpr size_t pixel_alignment = 64;
+
+    auto get_region_size(const rectangle& region) -> size_t
+    {
+        return region.is_empty() ? 0 : region.area() * sizeof(rgb_pixel);
+    }
+
+    class shard_writer
+    {
+        public:
+        shard_writer(const std::string& path, const long image_size)
+            : path(path),
+              fout(path, std::ios::binary),
+              image_size(image_size)
+        {
+            if (not fout.good())
+                throw std::runtime_error("ERROR: could not create " + path);
+        }
+
+        auto get_size() const -> size_t { return offset; }
+        auto get_num_images() const -> size_t { return images.size(); }
+
+        void add(packed_image&& info, const matrix<rgb_pixel>& letterbox)
+        {
+            const std::array<char, pixel_alignment> padding{};
+            const auto padding_size = pixel_alignment - offset % pixel_alignment;
+            if (padding_size < pixel_alignment)
+            {
+                fout.write(padding.data(), padding_size);
+                offset += padding_size;
+            }
+            info.offset = offset;
+            const auto& r = info.region;
+            if (not r.is_empty())
+            {
+                for (long row = r.top(); row <= r.bottom(); ++row)
+                {
+                    fout.write(
+                        reinterpret_cast<const char*>(&letterbox(row, r.left())),
+                        r.width() * sizeof(rgb_pixel));
+                }
+                offset += get_region_size(r);
+            }
+            images.push_back(std::move(info));
+        }
+
+        void close()
+        {
+            serialize(pack_version, fout);
+            serialize(image_size, fout);
+            serialize(images, fout);
+            const uint64_t index_offset = offset;
+            fout.write(reinterpret_cast<const char*>(&index_offset), sizeof(index_offset));
+            fout.write(pack_magic, magic_size);
+            fout.close();
+            if (not fout)
+                throw std::runtime_error("ERROR: could not write " + path);
+        }
+
+        private:
+        std::string path;
+        std::ofstream fout;
+        long image_size;
+        size_t offset = 0;
+        std::vector<packed_image> images;
+    };
+}  // namespace
+
+void serialize(const packed_image& item, std::ostream& out)
+{
+    dlib::serialize(item.filename, out);
+    dlib::serialize(item.offset, out);
+    dlib::serialize(item.region, out);
+    dlib::serialize(item.scale, out);
+    dlib::serialize(item.shift, out);
+}
+
+void deserialize(packed_image& item, std::istream& in)
+{
+    dlib::deserialize(item.filename, in);
+    dlib::deserialize(item.offset, in);
+    dlib::deserialize(item.region, in);
+    dlib::deserialize(item.scale, in);
+    dlib::deserialize(item.shift, in);
+}
+
+auto get_shard_path(const std::string& prefix, const size_t shard) -> std::string
+{
+    std::ostringstream path;
+    path << prefix << '-' << std::setw(5) << std::setfill('0') << shard << ".pack";
+    return path.str();
+}
+
+packed_dataset::packed_dataset(const std::string& prefix)
+{
+    for (size_t s = 0; fs::exists(get_shard_path(prefix, s)); ++s)
+    {
+        const auto path = get_shard_path(prefix, s);
+        const auto file_size = fs::file_size(path);
+        std::ifstream fin(path, std::ios::binary);
+        uint64_t index_offset = 0;
+        std::array<char, magic_size> magic{};
+        if (file_size >= footer_size)
+        {
+            fin.seekg(file_size - footer_size);
+            fin.read(reinterpret_cast<char*>(&index_offset), sizeof(index_offset));
+            fin.read(magic.data(), magic_size);
+        }
+        if (not fin or std::memcmp(magic.data(), pack_magic, magic_size) != 0 or
+            index_offset >= file_size)
+            throw std::runtime_error("ERROR: " + path + " is not a complete packed dataset");
+
+        std::string version;
+        long shard_image_size;
+        std::vector<packed_image> shard_images;
+        fin.seekg(index_offset);
+        deserialize(version, fin);
+        if (version != pack_version)
+            throw serialization_error("Unexpected version '" + version + "' found in " + path);
+        deserialize(shard_image_size, fin);
+        deserialize(shard_images, fin);
+        if (s > 0 and shard_image_size != image_size)
+            throw std::runtime_error("ERROR: " + path + " has a different image size");
+        image_size = shard_image_size;
+        for (auto& image : shard_images)
+        {
+            if (image.offset + get_region_size(image.region) > index_offset)
+                throw std::runtime_error("ERROR: " + path + " has a corrupted index");
+            images.emplace_back(s, std::move(image));
+        }
+
+        shard sh;
+        sh.size = file_size;
+        sh.fd = open(path.c_str(), O_RDONLY);
+        if (sh.fd == -1)
+            throw std::runtime_error("ERROR: could not open " + path);
+        void* data = mmap(nullptr, sh.size, PROT_READ, MAP_SHARED, sh.fd, 0);
+        if (data == MAP_FAILED)
+        {
+            ::close(sh.fd);
+            throw std::runtime_error("ERROR: could not map " + path + " in memory");
+        }
+        // the images are read in a random order
+        madvise(data, sh.size, MADV_RANDOM);
+        sh.data = static_cast<const unsigned char*>(data);
+        shards.push_back(sh);
+    }
+    if (shards.empty())
+        throw std::runtime_error("ERROR: could not find " + get_shard_path(prefix, 0));
+}
+
+packed_dataset::~packed_dataset()
+{
+    for (auto& sh : shards)
+    {
+        munmap(const_cast<unsigned char*>(sh.data), sh.size);
+        ::close(sh.fd);
+    }
+}
+
+void packed_dataset::check(const image_dataset_metadata::dataset& dataset, const long size) const
+{
+    if (size != image_size)
+        throw std::runtime_error(
+            "ERROR: the dataset was packed with size " + std::to_string(image_size) +
+            " instead of " + std::to_string(size));
+    if (dataset.images.size() != images.size())
+        throw std::runtime_error(
+            "ERROR: the packed dataset has " + std::to_string(images.size()) +
+            " images instead of " + std::to_string(dataset.images.size()));
+    for (size_t i = 0; i < images.size(); ++i)
+    {
+        if (dataset.images[i].filename != images[i].second.filename)
+            throw std::runtime_error(
+                "ERROR: the packed dataset has " + images[i].second.filename + " instead of " +
+                dataset.images[i].filename + ", pack it again");
+    }
+}
+
+auto packed_dataset::load(const size_t i, matrix<rgb_pixel>& output) const
+    -> point_transform_affine
+{
+    const auto& [s, info] = images.at(i);
+    const auto& r = info.region;
+    if (r.is_empty())
+        throw image_load_error(info.filename + " could not be loaded when it was packed");
+    output.set_size(image_size, image_size);
+    assign_all_pixels(output, rgb_pixel(0, 0, 0));
+    const auto* pixels = shards[s].data + info.offset;
+    const size_t row_size = r.width() * sizeof(rgb_pixel);
+    for (long row = r.top(); row <= r.bottom(); ++row, pixels += row_size)
+        std::memcpy(&output(row, r.left()), pixels, row_size);
+    return point_transform_affine(identity_matrix<double>(2) * info.scale, info.shift);
+}
+
+auto pack_dataset(
+    const std::string& dataset_dir,
+    const image_dataset_metadata::dataset& dataset,
+    const std::string& prefix,
+    const long image_size,
+    const size_t max_shard_size,
+    const size_t num_threads) -> size_t
+{
+    // the images are loaded in parallel by chunks, and written in order
+    const size_t chunk_size = std::max<size_t>(num_threads, 1) * 16;
+    std::vector<matrix<rgb_pixel>> letterboxes(chunk_size);
+    std::vector<packed_image> infos(chunk_size);
+    size_t num_shards = 0;
+    size_t num_errors = 0;
+    auto writer = std::make_unique<shard_writer>(get_shard_path(prefix, num_shards++), image_size);
+    for (size_t begin = 0; begin < dataset.images.size(); begin += chunk_size)
+    {
+        const auto end = std::min(begin + chunk_size, dataset.images.size());
+        parallel_for(
+            num_threads,
+            begin,
+            end,
+            [&](const size_t i)
+            {
+                const auto& image_info = dataset.images[i];
+                auto& info = infos[i - begin];
+                auto& letterbox = letterboxes[i - begin];
+                info = packed_image();
+                info.filename = image_info.filename;
+                matrix<rgb_pixel> image;
+                try
+                {
+                    load_image(image, dataset_dir + "/" + image_info.filename);
+                }
+                catch (const image_load_error& e)
+                {
+                    std::cerr << "ERROR: " << e.what() << std::endl;
+                    info.region = rectangle();
+                    return;
+                }
+                const auto tform = letterbox_image(image, letterbox, image_size);
+                info.scale = tform.get_m()(0, 0);
+                info.shift = tform.get_b();
+                const auto corner = tform(dpoint(image.nc(), image.nr()));
+                info.region = get_rect(letterbox).intersect(rectangle(
+                    std::lround(info.shift.x()),
+                    std::lround(info.shift.y()),
+                    std::lround(corner.x()) - 1,
+                    std::lround(corner.y()) - 1));
+            });
+
+        for (size_t i = 0; i < end - begin; ++i)
+        {
+            if (infos[i].region.is_empty())
+                ++num_errors;
+            const auto image_bytes = get_region_size(infos[i].region) + pixel_alignment;
+            if (writer->get_num_images() > 0 and
+                writer->get_size() + image_bytes > max_shard_size)
+            {
+                writer->close();
+                writer = std::make_unique<shard_writer>(
+                    get_shard_path(prefix, num_shards++),
+                    image_size);
+            }
+            writer->add(std::move(infos[i]), letterboxes[i]);
+        }
+        std::cout << "packed images: " << end << '/' << dataset.images.size() << ", shards: "
+                  << num_shards << "\r" << std::flush;
+    }
+    writer->close();
+    std::cout << '\n';
+
+    // remove the shards left by a previous run with more of them
+    while (fs::exists(get_shard_path(prefix, num_shards)))
+        fs::remove(get_shard_path(prefix, num_shards++));
+    return num_errors;
+}
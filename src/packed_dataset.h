@@ -0,0 +1,75 @@
+#ifndef packed_dataset_h_INCLUDED
+#define packed_dataset_h_INCLUDED
+
+#include <dlib/data_io.h>
+#include <dlib/image_transforms.h>
+
+// Where the pixels of an image are stored in a shard, and how it was letterboxed: the region
+// of the letterboxed image covered by the original one, and the transform that maps the
+// coordinates of the original image to the letterboxed one.  Images that could not be loaded
+// are stored with an empty region.
+struct packed_image
+{
+    std::string filename;
+    unsigned long offset = 0;
+    dlib::rectangle region;
+    double scale = 1;
+    dlib::dpoint shift;
+};
+
+void serialize(const packed_image& item, std::ostream& out);
+void deserialize(packed_image& item, std::istream& in);
+
+// A dataset packed by pack_dataset into the shards <prefix>-00000.pack, <prefix>-00001.pack...
+// Each shard holds the raw RGB pixels of its images, already letterboxed at a fixed size, and
+// ends with an index of the images.  The shards are memory-mapped, so loading an image is a
+// copy from the page cache, without opening a file nor decoding anything.  It can be shared
+// by any number of threads.
+class packed_dataset
+{
+    public:
+    packed_dataset() = delete;
+    explicit packed_dataset(const std::string& prefix);
+    ~packed_dataset();
+    packed_dataset(const packed_dataset&) = delete;
+    packed_dataset& operator=(const packed_dataset&) = delete;
+
+    size_t size() const { return images.size(); }
+    long get_image_size() const { return image_size; }
+    const packed_image& get_info(const size_t i) const { return images.at(i).second; }
+
+    // Throws if the images are not the ones of the dataset, in the same order, or if they were
+    // letterboxed at another size.
+    void check(const dlib::image_dataset_metadata::dataset& dataset, const long size) const;
+
+    // Copies the letterboxed image i into output and returns the transform from the original
+    // image coordinates, like dlib::letterbox_image does.  Throws a dlib::image_load_error if
+    // the image could not be loaded when the dataset was packed.
+    auto load(const size_t i, dlib::matrix<dlib::rgb_pixel>& output) const
+        -> dlib::point_transform_affine;
+
+    private:
+    struct shard
+    {
+        int fd = -1;
+        const unsigned char* data = nullptr;
+        size_t size = 0;
+    };
+    long image_size = 0;
+    std::vector<shard> shards;
+    std::vector<std::pair<size_t, packed_image>> images;
+};
+
+auto get_shard_path(const std::string& prefix, const size_t shard) -> std::string;
+
+// Writes the images, letterboxed at image_size, into shards of at most max_shard_size bytes.
+// Returns the number of images that could not be loaded.
+auto pack_dataset(
+    const std::string& dataset_dir,
+    const dlib::image_dataset_metadata::dataset& dataset,
+    const std::string& prefix,
+    const long image_size,
+    const size_t max_shard_size,
+    const size_t num_threads = std::thread::hardware_concurrency()) -> size_t;
+
+#endif  // packed_dataset_h_INCLUDED
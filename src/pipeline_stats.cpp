@@ -0,0 +1,136 @@
+#include "pipeline_stats.h"
+
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+    const std::array<const char*, pipeline_stats::num_stages> stage_names{
+        "load",
+        "warp",
+        "color",
+        "mosaic",
+        "mixup",
+        "sample",
+        "enqueue",
+        "dequeue",
+        "step"};
+
+    const std::array<const char*, pipeline_stats::num_gauges> gauge_names{
+        "train_queue",
+        "test_queue"};
+}  // namespace
+
+pipeline_stats::pipeline_stats(const std::string& output_path) : interval_start(clock::now())
+{
+    if (output_path.empty())
+        return;
+    output.open(output_path, std::ios::app);
+    if (not output)
+        throw std::runtime_error("ERROR: could not open " + output_path);
+    const std::string extension = ".csv";
+    output_csv = output_path.size() >= extension.size() and
+                 output_path.compare(
+                     output_path.size() - extension.size(),
+                     extension.size(),
+                     extension) == 0;
+    // a resumed training appends its rows under the existing header
+    output_header = output_csv and output.tellp() == 0;
+}
+
+void pipeline_stats::add(const stage s, const clock::duration elapsed)
+{
+    stages[s].calls.fetch_add(1, std::memory_order_relaxed);
+    stages[s].ticks.fetch_add(elapsed.count(), std::memory_order_relaxed);
+}
+
+void pipeline_stats::set_capacity(const gauge g, const size_t capacity)
+{
+    gauges[g].capacity = capacity;
+}
+
+void pipeline_stats::measure(const gauge g, const size_t value)
+{
+    auto& c = gauges[g];
+    c.min = c.samples == 0 ? value : std::min(c.min, value);
+    c.max = c.samples == 0 ? value : std::max(c.max, value);
+    c.sum += value;
+    ++c.samples;
+}
+
+void pipeline_stats::report(const size_t num_steps, std::ostream& out)
+{
+    using fsec = std::chrono::duration<double>;
+    const auto now = clock::now();
+    const double seconds = std::max(fsec(now - interval_start).count(), 1e-9);
+    interval_start = now;
+
+    // the values of the interval, flattened for the file output
+    std::vector<std::pair<std::string, double>> values{
+        {"step", num_steps},
+        {"seconds", seconds}};
+
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(3);
+    text << "pipeline stats at step " << num_steps << " (" << seconds << " s):\n";
+    for (size_t i = 0; i < num_stages; ++i)
+    {
+        const auto calls = stages[i].calls.exchange(0, std::memory_order_relaxed);
+        const auto ticks = stages[i].ticks.exchange(0, std::memory_order_relaxed);
+        const double total = fsec(clock::duration(ticks)).count();
+        const double mean_ms = calls > 0 ? 1000 * total / calls : 0;
+        const double threads = total / seconds;
+        const std::string name = stage_names[i];
+        values.emplace_back(name + "_calls", calls);
+        values.emplace_back(name + "_ms", mean_ms);
+        values.emplace_back(name + "_threads", threads);
+        if (calls == 0)
+            continue;
+        text << "  " << std::left << std::setw(12) << name << std::right << std::setw(10)
+             << calls << " calls " << std::setw(10) << mean_ms << " ms " << std::setw(7)
+             << threads << " threads\n";
+    }
+    for (size_t i = 0; i < num_gauges; ++i)
+    {
+        auto& g = gauges[i];
+        const double mean = g.samples > 0 ? static_cast<double>(g.sum) / g.samples : 0;
+        const std::string name = gauge_names[i];
+        values.emplace_back(name + "_mean", mean);
+        values.emplace_back(name + "_min", g.min);
+        values.emplace_back(name + "_max", g.max);
+        if (g.samples > 0)
+        {
+            text << "  " << std::left << std::setw(12) << name << std::right << " mean "
+                 << mean << '/' << g.capacity << ", min " << g.min << ", max " << g.max << '\n';
+        }
+        g = gauge_counter{g.capacity};
+    }
+    out << text.str() << std::flush;
+
+    if (not output.is_open())
+        return;
+    if (output_header)
+    {
+        for (size_t i = 0; i < values.size(); ++i)
+            output << (i > 0 ? "," : "") << values[i].first;
+        output << '\n';
+        output_header = false;
+    }
+    output << std::setprecision(6);
+    if (output_csv)
+    {
+        for (size_t i = 0; i < values.size(); ++i)
+            output << (i > 0 ? "," : "") << values[i].second;
+    }
+    else
+    {
+        output << '{';
+        for (size_t i = 0; i < values.size(); ++i)
+            output << (i > 0 ? ", " : "") << '"' << values[i].first << "\": " << values[i].second;
+        output << '}';
+    }
+    output << std::endl;
+}
@@ -0,0 +1,98 @@
+#ifndef pipeline_stats_h_INCLUDED
+#define pipeline_stats_h_INCLUDED
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <string>
+
+// Time spent in each stage of the training pipeline, and depth of its queues.  The loaders and
+// the trainer add to the counters from any thread with relaxed atomics, which costs a couple of
+// clock reads per stage.  Each report covers the interval since the previous one.
+//
+// The "threads" column of a stage is its total time over the wall time: the average number of
+// threads busy in that stage.  A trainer that spends its time in dequeue is waiting for the
+// loaders, and loaders that spend their time in enqueue are waiting for the trainer.
+class pipeline_stats
+{
+    public:
+    using clock = std::chrono::steady_clock;
+
+    enum stage : size_t
+    {
+        load,
+        warp,
+        color,
+        mosaic,
+        mixup,
+        sample,
+        enqueue,
+        dequeue,
+        step,
+        num_stages
+    };
+
+    enum gauge : size_t
+    {
+        train_queue,
+        test_queue,
+        num_gauges
+    };
+
+    class scoped_timer
+    {
+        public:
+        scoped_timer(pipeline_stats& stats, const stage s)
+            : stats(stats), s(s), start(clock::now())
+        {
+        }
+        scoped_timer(const scoped_timer&) = delete;
+        scoped_timer& operator=(const scoped_timer&) = delete;
+        ~scoped_timer() { stats.add(s, clock::now() - start); }
+
+        private:
+        pipeline_stats& stats;
+        stage s;
+        clock::time_point start;
+    };
+
+    // The reports are also appended to the file, as CSV if its name ends with .csv, and as JSON
+    // lines otherwise.
+    explicit pipeline_stats(const std::string& output_path = "");
+
+    auto time(const stage s) -> scoped_timer { return scoped_timer(*this, s); }
+    void add(const stage s, const clock::duration elapsed);
+
+    // Gauges are only measured and reported by the trainer thread
+    void set_capacity(const gauge g, const size_t capacity);
+    void measure(const gauge g, const size_t value);
+
+    // Writes the statistics since the previous report, and starts a new interval
+    void report(const size_t num_steps, std::ostream& out);
+
+    private:
+    struct stage_counter
+    {
+        std::atomic<size_t> calls{0};
+        std::atomic<clock::rep> ticks{0};
+    };
+
+    struct gauge_counter
+    {
+        size_t capacity = 0;
+        size_t samples = 0;
+        size_t sum = 0;
+        size_t min = 0;
+        size_t max = 0;
+    };
+
+    std::array<stage_counter, num_stages> stages;
+    std::array<gauge_counter, num_gauges> gauges;
+    clock::time_point interval_start;
+    std::ofstream output;
+    bool output_csv = false;
+    bool output_header = false;
+};
+
+#endif  // pipeline_stats_h_INCLUDED
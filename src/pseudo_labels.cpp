@@ -0,0 +1,150 @@
+#include "pseudo_labels.h"
+
+#include <filesystem>
+
+namespace fs = std::filesystem;
+using namespace dlib;
+
+void serialize(const pseudo_labels& item, std::ostream& out)
+{
+    dlib::serialize(item.index, out);
+    dlib::serialize(item.width, out);
+    dlib::serialize(item.height, out);
+    dlib::serialize(item.boxes.size(), out);
+    for (const auto& box : item.boxes)
+    {
+        dlib::serialize(box.rect, out);
+        dlib::serialize(box.label, out);
+    }
+}
+
+void deserialize(pseudo_labels& item, std::istream& in)
+{
+    size_t num_boxes;
+    dlib::deserialize(item.index, in);
+    dlib::deserialize(item.width, in);
+    dlib::deserialize(item.height, in);
+    dlib::deserialize(num_boxes, in);
+    item.boxes.resize(num_boxes);
+    for (auto& box : item.boxes)
+    {
+        box = image_dataset_metadata::box();
+        dlib::deserialize(box.rect, in);
+        dlib::deserialize(box.label, in);
+    }
+}
+
+namespace
+{
+    // Reads the labels until the end of the file, and returns the offset after the last
+    // complete record.
+    auto read_labels(std::istream& in, std::vector<pseudo_labels>& labels) -> std::streamoff
+    {
+        std::streamoff end = in.tellg();
+        pseudo_labels item;
+        while (in.peek() != EOF)
+        {
+            try
+            {
+                deserialize(item, in);
+            }
+            catch (const serialization_error&)
+            {
+                break;
+            }
+            labels.push_back(std::move(item));
+            end = in.tellg();
+        }
+        return end;
+    }
+
+    void check_settings(std::istream& in, const std::string& path, const std::string& settings)
+    {
+        std::string file_settings;
+        deserialize(file_settings, in);
+        if (file_settings != settings)
+            throw std::runtime_error(
+                "ERROR: " + path + " was written with other settings (" + file_settings +
+                "), remove it to start over");
+    }
+}  // namespace
+
+pseudo_checkpoint::pseudo_checkpoint(const std::string& path, const std::string& settings)
+    : path(path)
+{
+    std::streamoff end = 0;
+    if (fs::exists(path) and fs::file_size(path) > 0)
+    {
+        std::ifstream fin(path, std::ios::binary);
+        check_settings(fin, path, settings);
+        end = read_labels(fin, labels);
+    }
+
+    if (end > 0)
+    {
+        // drop the incomplete record left by an interrupted run, if any
+        fs::resize_file(path, end);
+        fout.open(path, std::ios::binary | std::ios::app);
+    }
+    else
+    {
+        fout.open(path, std::ios::binary | std::ios::trunc);
+        dlib::serialize(settings, fout);
+        fout.flush();
+    }
+    if (not fout.good())
+        throw std::runtime_error("ERROR: unable to open " + path + " for writing");
+}
+
+void pseudo_checkpoint::append(const std::vector<pseudo_labels>& new_labels)
+{
+    for (const auto& item : new_labels)
+        serialize(item, fout);
+    fout.flush();
+    if (not fout.good())
+        throw std::runtime_error("ERROR: unable to write to " + path);
+    labels.insert(labels.end(), new_labels.begin(), new_labels.end());
+}
+
+auto get_checkpoint_path(
+    const std::string& dataset_path,
+    const unsigned long shard,
+    const unsigned long num_shards) -> std::string
+{
+    fs::path path(dataset_path);
+    const auto suffix =
+        "-pseudo-" + std::to_string(shard) + "of" + std::to_string(num_shards) + ".dat";
+    return path.replace_extension().string() + suffix;
+}
+
+auto read_pseudo_checkpoint(const std::string& path, const std::string& settings)
+    -> std::vector<pseudo_labels>
+{
+    std::ifstream fin(path, std::ios::binary);
+    if (not fin.good())
+        throw std::runtime_error("ERROR: unable to open " + path + " for reading");
+    check_settings(fin, path, settings);
+    std::vector<pseudo_labels> labels;
+    read_labels(fin, labels);
+    return labels;
+}
+
+auto merge_pseudo_labels(
+    image_dataset_metadata::dataset& dataset,
+    const std::vector<pseudo_labels>& labels) -> size_t
+{
+    size_t num_updated = 0;
+    for (const auto& item : labels)
+    {
+        if (item.index >= dataset.images.size())
+            throw std::runtime_error(
+                "ERROR: pseudo-labels for image " + std::to_string(item.index) +
+                " but the dataset only has " + std::to_string(dataset.images.size()));
+        auto& image_info = dataset.images[item.index];
+        image_info.width = item.width;
+        image_info.height = item.height;
+        image_info.boxes.insert(image_info.boxes.end(), item.boxes.begin(), item.boxes.end());
+        ++num_updated;
+    }
+    return num_updated;
+}
@@ -0,0 +1,54 @@
+#ifndef pseudo_labels_h_INCLUDED
+#define pseudo_labels_h_INCLUDED
+
+#include <dlib/data_io.h>
+#include <fstream>
+
+// The pseudo-labels found for one image of the dataset
+struct pseudo_labels
+{
+    unsigned long index = 0;
+    long width = 0;
+    long height = 0;
+    std::vector<dlib::image_dataset_metadata::box> boxes;
+};
+
+void serialize(const pseudo_labels& item, std::ostream& out);
+void deserialize(pseudo_labels& item, std::istream& in);
+
+// Append-only file with the pseudo-labels of the images processed so far by one shard.  It
+// starts with a string describing the settings used to compute the labels, so that a run
+// is never resumed with a different network or thresholds.  A record cut short by a crash is
+// ignored when reading the file back, and its image is processed again.
+class pseudo_checkpoint
+{
+    public:
+    pseudo_checkpoint() = delete;
+    pseudo_checkpoint(const std::string& path, const std::string& settings);
+
+    // the images that were already processed, in the order they were written
+    const std::vector<pseudo_labels>& get_labels() const { return labels; }
+
+    void append(const std::vector<pseudo_labels>& new_labels);
+
+    private:
+    std::string path;
+    std::vector<pseudo_labels> labels;
+    std::ofstream fout;
+};
+
+auto get_checkpoint_path(
+    const std::string& dataset_path,
+    const unsigned long shard,
+    const unsigned long num_shards) -> std::string;
+
+// Reads all the labels in a checkpoint file, throws if it was written with other settings
+auto read_pseudo_checkpoint(const std::string& path, const std::string& settings)
+    -> std::vector<pseudo_labels>;
+
+// Adds the pseudo-labels to the images of the dataset and returns how many images were updated
+auto merge_pseudo_labels(
+    dlib::image_dataset_metadata::dataset& dataset,
+    const std::vector<pseudo_labels>& labels) -> size_t;
+
+#endif  // pseudo_labels_h_INCLUDED
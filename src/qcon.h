@@ -0,0 +1,388 @@
+#ifndef qcon_h_INCLUDED
+#define qcon_h_INCLUDED
+
+#include "int8_conv.h"
+#include "packed_conv.h"
+
+#include <dlib/dnn.h>
+
+// How the weights of a qcon_ are stored
+enum class qcon_format
+{
+    calibrating,  // the parameters of the con_, run with dlib
+    int8,         // run with int8_conv
+    bf16,         // run with packed_conv
+    fp32,         // run with packed_conv
+};
+
+// A convolution for CPU inference, whose weights can be used in place from a mapped file, with
+// reduced precision or not, converted from a dlib::con_ with the same parameters.  A converted
+// layer starts in calibration mode: it runs with dlib and records the range of its input,
+// averaged over the calibration batches.  Then either finish_calibration() quantizes the filters
+// per output channel, and the input with the recorded range, after which the layer runs with
+// int8_conv, or convert_to_bf16() rounds the filters to bfloat16 for packed_conv, which needs no
+// calibration, and neither does convert_to_fp32(), which keeps them in single precision.  It can
+// not be trained.
+template <
+    long _num_filters,
+    long _nr,
+    long _nc,
+    int _stride_y,
+    int _stride_x,
+    int _padding_y = _stride_y != 1 ? 0 : _nr / 2,
+    int _padding_x = _stride_x != 1 ? 0 : _nc / 2>
+class qcon_
+{
+    public:
+    qcon_() = default;
+
+    qcon_(const dlib::con_<_num_filters, _nr, _nc, _stride_y, _stride_x, _padding_y, _padding_x>&
+              item)
+        : params(item.get_layer_params()),
+          use_bias(not item.bias_is_disabled()),
+          format(qcon_format::calibrating)
+    {
+    }
+
+    template <typename SUBNET> void setup(const SUBNET&)
+    {
+        if ((format == qcon_format::int8 and filters.weights.empty()) or
+            (format == qcon_format::bf16 and half_filters.weights.empty()) or
+            (format == qcon_format::fp32 and float_filters.weights.empty()))
+            throw dlib::error("ERROR: qcon_ layers must be converted from a trained con_");
+    }
+
+    template <typename SUBNET> void forward(const SUBNET& sub, dlib::resizable_tensor& output)
+    {
+        const auto& input = sub.get_output();
+        const long out_nr = 1 + (input.nr() + 2 * _padding_y - _nr) / _stride_y;
+        const long out_nc = 1 + (input.nc() + 2 * _padding_x - _nc) / _stride_x;
+        if (format == qcon_format::calibrating)
+        {
+            const auto range = std::minmax_element(input.host(), input.host() + input.size());
+            min_sum += *range.first;
+            max_sum += *range.second;
+            ++num_batches;
+            dlib::alias_tensor filters_alias(_num_filters, input.k(), _nr, _nc);
+            dlib::tt::tensor_conv conv;
+            conv.setup(
+                input,
+                filters_alias(params, 0),
+                _stride_y,
+                _stride_x,
+                _padding_y,
+                _padding_x);
+            conv(false, output, input, filters_alias(params, 0));
+            if (use_bias)
+            {
+                dlib::alias_tensor biases_alias(1, _num_filters);
+                dlib::tt::add(1, output, 1, biases_alias(params, filters_alias.size()));
+            }
+            return;
+        }
+        output.set_size(input.num_samples(), _num_filters, out_nr, out_nc);
+        if (format == qcon_format::bf16)
+        {
+            DLIB_CASSERT(input.k() == half_filters.k);
+            packed_conv(
+                input.host(),
+                input.num_samples(),
+                input.nr(),
+                input.nc(),
+                half_filters,
+                _stride_y,
+                _stride_x,
+                _padding_y,
+                _padding_x,
+                output.host(),
+                out_nr,
+                out_nc);
+            return;
+        }
+        if (format == qcon_format::fp32)
+        {
+            DLIB_CASSERT(input.k() == float_filters.k);
+            packed_conv(
+                input.host(),
+                input.num_samples(),
+                input.nr(),
+                input.nc(),
+                float_filters,
+                _stride_y,
+                _stride_x,
+                _padding_y,
+                _padding_x,
+                output.host(),
+                out_nr,
+                out_nc);
+            return;
+        }
+        DLIB_CASSERT(input.k() == filters.k);
+        int8_conv(
+            input.host(),
+            input.num_samples(),
+            input.nr(),
+            input.nc(),
+            quantization,
+            filters,
+            _stride_y,
+            _stride_x,
+            _padding_y,
+            _padding_x,
+            output.host(),
+            out_nr,
+            out_nc);
+    }
+
+    template <typename SUBNET> void backward(const dlib::tensor&, SUBNET&, dlib::tensor&)
+    {
+        throw dlib::error("ERROR: qcon_ layers are for inference only");
+    }
+
+    void finish_calibration()
+    {
+        if (format != qcon_format::calibrating)
+            return;
+        if (num_batches == 0)
+            throw dlib::error("ERROR: a qcon_ layer saw no calibration data");
+        const long filter_size = _nr * _nc * _num_filters;
+        const long k = get_num_inputs();
+        quantization = get_input_quantization(min_sum / num_batches, max_sum / num_batches);
+        quantize_filters(
+            params.host(),
+            use_bias ? params.host() + k * filter_size : nullptr,
+            _num_filters,
+            k,
+            _nr,
+            _nc,
+            filters);
+        params.clear();
+        format = qcon_format::int8;
+    }
+
+    void convert_to_bf16()
+    {
+        if (format != qcon_format::calibrating)
+            return;
+        const long filter_size = _nr * _nc * _num_filters;
+        const long k = get_num_inputs();
+        convert_filters(
+            params.host(),
+            use_bias ? params.host() + k * filter_size : nullptr,
+            _num_filters,
+            k,
+            _nr,
+            _nc,
+            half_filters);
+        params.clear();
+        format = qcon_format::bf16;
+    }
+
+    void convert_to_fp32()
+    {
+        if (format != qcon_format::calibrating)
+            return;
+        const long filter_size = _nr * _nc * _num_filters;
+        const long k = get_num_inputs();
+        convert_filters(
+            params.host(),
+            use_bias ? params.host() + k * filter_size : nullptr,
+            _num_filters,
+            k,
+            _nr,
+            _nc,
+            float_filters);
+        params.clear();
+        format = qcon_format::fp32;
+    }
+
+    qcon_format get_format() const { return format; }
+
+    // The bytes of the converted weights, so that they can be stored apart from the layer.
+    // set_weights() uses them in place: they must outlive the layer and its copies.
+    auto get_weights() const -> std::pair<const void*, size_t>
+    {
+        if (format == qcon_format::bf16)
+        {
+            const auto& w = half_filters.weights;
+            return {w.data(), w.size() * sizeof(uint16_t)};
+        }
+        if (format == qcon_format::fp32)
+        {
+            const auto& w = float_filters.weights;
+            return {w.data(), w.size() * sizeof(float)};
+        }
+        return {filters.weights.data(), filters.weights.size()};
+    }
+
+    void set_weights(const void* data, const size_t size)
+    {
+        if (format == qcon_format::bf16)
+            half_filters.weights.set_view(static_cast<const uint16_t*>(data), size / 2);
+        else if (format == qcon_format::fp32)
+            float_filters.weights.set_view(static_cast<const float*>(data), size / 4);
+        else if (format == qcon_format::int8)
+            filters.weights.set_view(static_cast<const int8_t*>(data), size);
+    }
+
+    // the floating point parameters, only there during the calibration
+    const dlib::tensor& get_layer_params() const { return params; }
+    dlib::tensor& get_layer_params() { return params; }
+
+    friend void serialize(const qcon_& item, std::ostream& out)
+    {
+        if (item.format == qcon_format::calibrating)
+        {
+            throw dlib::serialization_error(
+                "ERROR: qcon_ layers can't be saved while calibrating");
+        }
+        if (item.format == qcon_format::bf16)
+            dlib::serialize("qcon_bf16", out);
+        else if (item.format == qcon_format::fp32)
+            dlib::serialize("qcon_fp32", out);
+        else
+            dlib::serialize("qcon_", out);
+        dlib::serialize(_num_filters, out);
+        dlib::serialize(_nr, out);
+        dlib::serialize(_nc, out);
+        dlib::serialize(_stride_y, out);
+        dlib::serialize(_stride_x, out);
+        dlib::serialize(_padding_y, out);
+        dlib::serialize(_padding_x, out);
+        if (item.format == qcon_format::bf16)
+        {
+            serialize(item.half_filters, out);
+            return;
+        }
+        if (item.format == qcon_format::fp32)
+        {
+            serialize(item.float_filters, out);
+            return;
+        }
+        dlib::serialize(item.quantization.scale, out);
+        dlib::serialize(item.quantization.zero_point, out);
+        serialize(item.filters, out);
+    }
+
+    friend void deserialize(qcon_& item, std::istream& in)
+    {
+        std::string version;
+        dlib::deserialize(version, in);
+        if (version != "qcon_" and version != "qcon_bf16" and version != "qcon_fp32")
+            throw dlib::serialization_error("Unexpected version '" + version + "' for qcon_");
+        long num_filters, nr, nc;
+        int stride_y, stride_x, padding_y, padding_x;
+        dlib::deserialize(num_filters, in);
+        dlib::deserialize(nr, in);
+        dlib::deserialize(nc, in);
+        dlib::deserialize(stride_y, in);
+        dlib::deserialize(stride_x, in);
+        dlib::deserialize(padding_y, in);
+        dlib::deserialize(padding_x, in);
+        if (num_filters != _num_filters or nr != _nr or nc != _nc or stride_y != _stride_y or
+            stride_x != _stride_x or padding_y != _padding_y or padding_x != _padding_x)
+            throw dlib::serialization_error("Wrong parameters found while deserializing qcon_");
+        item.params.clear();
+        if (version == "qcon_bf16")
+        {
+            deserialize(item.half_filters, in);
+            item.format = qcon_format::bf16;
+            return;
+        }
+        if (version == "qcon_fp32")
+        {
+            deserialize(item.float_filters, in);
+            item.format = qcon_format::fp32;
+            return;
+        }
+        dlib::deserialize(item.quantization.scale, in);
+        dlib::deserialize(item.quantization.zero_point, in);
+        deserialize(item.filters, in);
+        item.format = qcon_format::int8;
+    }
+
+    friend std::ostream& operator<<(std::ostream& out, const qcon_& item)
+    {
+        out << "qcon\t (num_filters=" << _num_filters << ", nr=" << _nr << ", nc=" << _nc
+            << ", stride_y=" << _stride_y << ", stride_x=" << _stride_x
+            << ", padding_y=" << _padding_y << ", padding_x=" << _padding_x << ")";
+        out << ' ' << item.get_format_name();
+        return out;
+    }
+
+    friend void to_xml(const qcon_& item, std::ostream& out)
+    {
+        out << "<qcon num_filters='" << _num_filters << "' nr='" << _nr << "' nc='" << _nc
+            << "' stride_y='" << _stride_y << "' stride_x='" << _stride_x << "' padding_y='"
+            << _padding_y << "' padding_x='" << _padding_x << "' format='"
+            << item.get_format_name() << "'/>\n";
+    }
+
+    private:
+    // the number of input channels, from the size of the floating point parameters
+    long get_num_inputs() const
+    {
+        return (params.size() - (use_bias ? _num_filters : 0)) / (_nr * _nc * _num_filters);
+    }
+
+    const char* get_format_name() const
+    {
+        switch (format)
+        {
+        case qcon_format::int8:
+            return "int8";
+        case qcon_format::bf16:
+            return "bf16";
+        case qcon_format::fp32:
+            return "fp32";
+        default:
+            return "calibrating";
+        }
+    }
+
+    dlib::resizable_tensor params;
+    bool use_bias = true;
+    qcon_format format = qcon_format::int8;
+    double min_sum = 0;
+    double max_sum = 0;
+    long num_batches = 0;
+    int8_input quantization;
+    int8_filters filters;
+    bf16_filters half_filters;
+    fp32_filters float_filters;
+};
+
+// Ends the calibration of the qcon_ layers, for dlib::visit_computational_layers
+template <typename LAYER> void finish_calibration(LAYER&)
+{
+}
+
+template <long NF, long NR, long NC, int SY, int SX, int PY, int PX>
+void finish_calibration(qcon_<NF, NR, NC, SY, SX, PY, PX>& layer)
+{
+    layer.finish_calibration();
+}
+
+// Converts the qcon_ layers to bfloat16, for dlib::visit_computational_layers
+template <typename LAYER> void convert_to_bf16(LAYER&)
+{
+}
+
+template <long NF, long NR, long NC, int SY, int SX, int PY, int PX>
+void convert_to_bf16(qcon_<NF, NR, NC, SY, SX, PY, PX>& layer)
+{
+    layer.convert_to_bf16();
+}
+
+// Converts the qcon_ layers to packed single precision, for dlib::visit_computational_layers
+template <typename LAYER> void convert_to_fp32(LAYER&)
+{
+}
+
+template <long NF, long NR, long NC, int SY, int SX, int PY, int PX>
+void convert_to_fp32(qcon_<NF, NR, NC, SY, SX, PY, PX>& layer)
+{
+    layer.convert_to_fp32();
+}
+
+#endif  // qcon_h_INCLUDED
@@ -0,0 +1,218 @@
+#include "metrics.h"
+#include "model.h"
+#include "sgd_trainer.h"
+
+#include <dlib/cmd_line_parser.h>
+#include <dlib/data_io.h>
+#include <dlib/svm.h>
+#include <filesystem>
+
+using namespace dlib;
+using fms = std::chrono::duration<float, std::milli>;
+namespace fs = std::filesystem;
+using rgb_image = matrix<rgb_pixel>;
+
+// Loads and letterboxes the images of a dataset XML file in the background
+class dataset_reader
+{
+    public:
+    dataset_reader(
+        const std::string& path,
+        const long image_size,
+        const size_t num_workers,
+        const size_t max_images = 0)
+        : dataset_dir(get_parent_directory(file(path)).full_name()),
+          data(1000)
+    {
+        image_dataset_metadata::load_image_dataset_metadata(dataset, path);
+        if (max_images > 0 and max_images < dataset.images.size())
+        {
+            // a fixed subset, spread over the whole dataset
+            dlib::rand rnd(0);
+            randomize_samples(dataset.images, rnd);
+            dataset.images.resize(max_images);
+        }
+        loader = std::make_unique<test_data_loader>(
+            dataset_dir,
+            dataset,
+            data,
+            image_size,
+            num_workers);
+        loader_thread = std::thread([this]() { loader->run(); });
+    }
+
+    ~dataset_reader()
+    {
+        data.disable();
+        loader_thread.join();
+    }
+
+    const std::string dataset_dir;
+    image_dataset_metadata::dataset dataset;
+    dlib::pipe<image_info> data;
+
+    private:
+    std::unique_ptr<test_data_loader> loader;
+    std::thread loader_thread;
+};
+
+struct evaluation
+{
+    metrics_details metrics;
+    // inference time of one image, without the loading
+    double ms_per_image = 0;
+};
+
+auto evaluate(
+    model& net,
+    const std::vector<rgb_image>& images,
+    const fs::path& test_path,
+    const long image_size,
+    const size_t batch_size,
+    const size_t num_workers,
+    const double conf_thresh) -> evaluation
+{
+    evaluation result;
+    // warm up the buffers, then time the inference on the calibration images
+    const auto warmup_end = images.begin() + std::min(batch_size, images.size());
+    net(std::vector<rgb_image>(images.begin(), warmup_end), batch_size);
+    const auto t0 = std::chrono::steady_clock::now();
+    net(images, batch_size, conf_thresh);
+    const auto t1 = std::chrono::steady_clock::now();
+    result.ms_per_image = std::chrono::duration_cast<fms>(t1 - t0).count() / images.size();
+    if (not test_path.empty())
+    {
+        dataset_reader reader(test_path, image_size, num_workers);
+        result.metrics =
+            compute_metrics(net, reader.dataset, batch_size, reader.data, conf_thresh);
+    }
+    return result;
+}
+
+auto main(const int argc, const char** argv) -> int
+try
+{
+    const auto num_threads = std::thread::hardware_concurrency();
+    const auto num_threads_str = std::to_string(num_threads);
+    command_line_parser parser;
+    parser.add_option("arch", "network architecture if not in the file (default: yolov7)", 1);
+    parser.add_option("batch", "batch size for calibration and inference (default: 8)", 1);
+    parser.add_option("calibration", "dataset XML file with the calibration images", 1);
+    parser.add_option("conf", "detection confidence threshold (default: 0.25)", 1);
+    parser.add_option("images", "number of calibration images (default: 256)", 1);
+    parser.add_option("mappable", "write a memory-mappable file, faster to load");
+    parser.add_option("output", "path to the quantized network (default: int8.dnn)", 1);
+    parser.add_option("size", "image size for calibration and inference (default: 512)", 1);
+    parser.add_option("test", "dataset XML file to compare the fp32 and int8 networks", 1);
+    parser.add_option("workers", "number data loaders (default: " + num_threads_str + ")", 1);
+    parser.set_group_name("Help Options");
+    parser.add_option("h", "alias for --help");
+    parser.add_option("help", "display this message and exit");
+    parser.parse(argc, argv);
+
+    if (parser.number_of_arguments() == 0 or parser.option("h") or parser.option("help"))
+    {
+        std::cout << "Usage: " << argv[0] << " [OPTION]… PATH/TO/NETWORK.dnn\n";
+        std::cout << "Quantizes the convolutions of a network to 8 bits, with the ranges of\n"
+                  << "their inputs recorded on the calibration images.\n";
+        parser.print_options();
+        return EXIT_SUCCESS;
+    }
+    parser.check_option_arg_range<size_t>("size", 224, 2048);
+    parser.check_option_arg_range<size_t>("batch", 1, 1024);
+    parser.check_option_arg_range<size_t>("images", 1, 100'000);
+    parser.check_option_arg_range<double>("conf", 0, 1);
+    if (not parser.option("calibration"))
+        throw std::runtime_error("ERROR: the calibration images must be given with --calibration");
+
+    const fs::path net_path(parser[0]);
+    const fs::path calibration_path = get_option(parser, "calibration", "");
+    const fs::path test_path = get_option(parser, "test", "");
+    const fs::path output_path = get_option(parser, "output", "int8.dnn");
+    const size_t batch_size = get_option(parser, "batch", 8);
+    const size_t num_images = get_option(parser, "images", 256);
+    const size_t num_workers = get_option(parser, "workers", num_threads);
+    const long image_size = get_option(parser, "size", 512);
+    const double conf_thresh = get_option(parser, "conf", 0.25);
+
+    model net(get_option(parser, "arch", "yolov7"));
+    std::clog << "loading network from " << net_path;
+    auto t0 = std::chrono::steady_clock::now();
+    if (net_path.extension() == ".dnn")
+    {
+        net.load_infer(net_path);
+    }
+    else
+    {
+        sgd_trainer trainer(net);
+        trainer.load_from_synchronization_file(net_path);
+    }
+    if (net.get_precision() != inference_precision::fp32)
+    {
+        throw std::runtime_error(
+            "ERROR: the convolutions of " + net_path.string() + " are already converted");
+    }
+    net.fuse();
+    auto t1 = std::chrono::steady_clock::now();
+    std::clog << " (" << std::chrono::duration_cast<fms>(t1 - t0).count() << " ms)\n";
+
+    std::vector<rgb_image> images;
+    {
+        dataset_reader reader(calibration_path, image_size, num_workers, num_images);
+        images.reserve(reader.dataset.images.size());
+        image_info temp;
+        while (images.size() < reader.dataset.images.size() and reader.data.dequeue(temp))
+            images.push_back(std::move(temp.image));
+    }
+    if (images.empty())
+        throw std::runtime_error("ERROR: no calibration images in " + calibration_path.string());
+
+    evaluation fp32;
+    if (not test_path.empty())
+    {
+        std::cout << "evaluating the fp32 network\n";
+        fp32 = evaluate(net, images, test_path, image_size, batch_size, num_workers, conf_thresh);
+    }
+
+    std::clog << "calibrating on " << images.size() << " images";
+    t0 = std::chrono::steady_clock::now();
+    for (size_t begin = 0; begin < images.size(); begin += batch_size)
+    {
+        const auto end = images.begin() + std::min(begin + batch_size, images.size());
+        net.calibrate(std::vector<rgb_image>(images.begin() + begin, end));
+    }
+    net.quantize();
+    t1 = std::chrono::steady_clock::now();
+    std::clog << " (" << std::chrono::duration_cast<fms>(t1 - t0).count() << " ms)\n";
+
+    if (not test_path.empty())
+    {
+        std::cout << "evaluating the int8 network\n";
+        const auto int8 =
+            evaluate(net, images, test_path, image_size, batch_size, num_workers, conf_thresh);
+        std::cout << '\n'
+                  << "            mAP     AP   AP50   ms/image\n"
+                  << std::fixed << std::setprecision(4) << "fp32     " << fp32.metrics.map << ' '
+                  << fp32.metrics.coco_map << ' ' << fp32.metrics.coco_map_50 << ' '
+                  << std::setprecision(2) << std::setw(10) << fp32.ms_per_image << '\n'
+                  << std::setprecision(4) << "int8     " << int8.metrics.map << ' '
+                  << int8.metrics.coco_map << ' ' << int8.metrics.coco_map_50 << ' '
+                  << std::setprecision(2) << std::setw(10) << int8.ms_per_image << '\n'
+                  << "speedup: " << fp32.ms_per_image / int8.ms_per_image << "x, mAP change: "
+                  << std::showpos << std::setprecision(4) << int8.metrics.map - fp32.metrics.map
+                  << std::noshowpos << '\n';
+    }
+
+    std::clog << "saving network to " << output_path;
+    t0 = std::chrono::steady_clock::now();
+    net.save_infer(output_path, parser.option("mappable"));
+    t1 = std::chrono::steady_clock::now();
+    std::clog << " (" << std::chrono::duration_cast<fms>(t1 - t0).count() << " ms)\n";
+
+    return EXIT_SUCCESS;
+}
+catch (const std::exception& e)
+{
+    std::cerr << e.what() << '\n';
+    return EXIT_FAILURE;
+}
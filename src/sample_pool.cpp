@@ -0,0 +1,30 @@
+#include "sample_pool.h"
+
+sample_pool::sample_pool(const size_t max_size) : max_size(max_size)
+{
+    buffers.reserve(max_size);
+}
+
+void sample_pool::get(training_sample& sample)
+{
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        if (not buffers.empty())
+        {
+            std::swap(sample, buffers.back());
+            buffers.pop_back();
+        }
+    }
+    sample.second.clear();
+}
+
+void sample_pool::put(dlib::matrix<dlib::rgb_pixel>& image, std::vector<dlib::yolo_rect>& boxes)
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    if (buffers.size() < max_size)
+    {
+        buffers.emplace_back();
+        buffers.back().first.swap(image);
+        buffers.back().second.swap(boxes);
+    }
+}
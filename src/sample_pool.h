@@ -0,0 +1,32 @@
+#ifndef sample_pool_h_INCLUDED
+#define sample_pool_h_INCLUDED
+
+#include <dlib/dnn.h>
+#include <mutex>
+
+using training_sample = std::pair<dlib::matrix<dlib::rgb_pixel>, std::vector<dlib::yolo_rect>>;
+
+// Recyclable buffers for the training samples, shared by the loaders and the trainer.  The
+// trainer gives the buffers of a mini-batch back once they have been copied to the network
+// input, and the loaders fill them again: in the steady state, the images keep their size and
+// the boxes their capacity, so building a sample does not allocate any memory.
+class sample_pool
+{
+    public:
+    sample_pool() = delete;
+    explicit sample_pool(const size_t max_size);
+
+    // Swaps a buffer of the pool with the sample, if the pool is not empty.  The boxes of the
+    // sample are cleared.
+    void get(training_sample& sample);
+
+    // Swaps the image and boxes into the pool, unless it is full.
+    void put(dlib::matrix<dlib::rgb_pixel>& image, std::vector<dlib::yolo_rect>& boxes);
+
+    private:
+    size_t max_size;
+    std::mutex mutex;
+    std::vector<training_sample> buffers;
+};
+
+#endif  // sample_pool_h_INCLUDED
@@ -0,0 +1,634 @@
+#include "detector_utils.h"
+#include "inference_engine.h"
+#include "model.h"
+
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <cstring>
+#include <dlib/cmd_line_parser.h>
+#include <dlib/opencv.h>
+#include <dlib/pipe.h>
+#include <fcntl.h>
+#include <mutex>
+#include <netinet/in.h>
+#include <nlohmann/json.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace dlib;
+using json = nlohmann::json;
+using rgb_image = matrix<rgb_pixel>;
+using fms = std::chrono::duration<float, std::milli>;
+
+namespace
+{
+    struct http_request
+    {
+        std::string method;
+        std::string path;
+        std::string query;
+        std::string body;
+        bool keep_alive = true;
+    };
+
+    // A client connection, with the bytes received after its last request
+    struct connection
+    {
+        int fd = -1;
+        std::string buffer;
+    };
+
+    // whether the buffer already holds the header of the next request
+    auto has_request(const std::string& buffer) -> bool
+    {
+        return buffer.find("\r\n\r\n") != std::string::npos;
+    }
+
+    auto get_reason(const int status) -> const char*
+    {
+        switch (status)
+        {
+        case 200:
+            return "OK";
+        case 400:
+            return "Bad Request";
+        case 404:
+            return "Not Found";
+        case 405:
+            return "Method Not Allowed";
+        case 411:
+            return "Length Required";
+        case 413:
+            return "Payload Too Large";
+        case 431:
+            return "Request Header Fields Too Large";
+        default:
+            return "Internal Server Error";
+        }
+    }
+
+    auto to_lower(std::string s) -> std::string
+    {
+        std::transform(
+            s.begin(),
+            s.end(),
+            s.begin(),
+            [](const unsigned char c) { return std::tolower(c); });
+        return s;
+    }
+
+    auto trim(const std::string& s) -> std::string
+    {
+        const auto begin = s.find_first_not_of(" \t\r");
+        if (begin == std::string::npos)
+            return "";
+        return s.substr(begin, s.find_last_not_of(" \t\r") - begin + 1);
+    }
+
+    // appends the next bytes of the connection to the buffer
+    auto receive(const int fd, std::string& buffer) -> bool
+    {
+        char chunk[1 << 16];
+        while (true)
+        {
+            const auto n = ::recv(fd, chunk, sizeof(chunk), 0);
+            if (n > 0)
+            {
+                buffer.append(chunk, n);
+                return true;
+            }
+            if (n < 0 and errno == EINTR)
+                continue;
+            return false;
+        }
+    }
+
+    auto send_all(const int fd, const std::string& data) -> bool
+    {
+        size_t sent = 0;
+        while (sent < data.size())
+        {
+            const auto n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n < 0 and errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            sent += n;
+        }
+        return true;
+    }
+
+    auto send_response(const int fd, const int status, const json& body, const bool keep_alive)
+        -> bool
+    {
+        const auto content = body.dump();
+        std::ostringstream sout;
+        sout << "HTTP/1.1 " << status << ' ' << get_reason(status) << "\r\n"
+             << "Content-Type: application/json\r\n"
+             << "Content-Length: " << content.size() << "\r\n"
+             << "Connection: " << (keep_alive ? "keep-alive" : "close") << "\r\n\r\n"
+             << content;
+        return send_all(fd, sout.str());
+    }
+
+    // Reads the next request of the connection.  The bytes received after it stay in the buffer
+    // for the next request.  Returns 200 for a complete request, 0 if the connection was closed,
+    // or the HTTP status of the error.  Only requests with a Content-Length are supported.
+    auto read_request(
+        const int fd,
+        std::string& buffer,
+        http_request& request,
+        const size_t max_body_size) -> int
+    {
+        const size_t max_header_size = 1 << 16;
+        size_t header_end;
+        while ((header_end = buffer.find("\r\n\r\n")) == std::string::npos)
+        {
+            if (buffer.size() > max_header_size)
+                return 431;
+            if (not receive(fd, buffer))
+                return 0;
+        }
+
+        std::istringstream header(buffer.substr(0, header_end));
+        buffer.erase(0, header_end + 4);
+        std::string line, target, version;
+        std::getline(header, line);
+        std::istringstream(line) >> request.method >> target >> version;
+        if (request.method.empty() or target.empty())
+            return 400;
+        const auto question = target.find('?');
+        request.path = target.substr(0, question);
+        request.query = question == std::string::npos ? "" : target.substr(question + 1);
+        request.keep_alive = version != "HTTP/1.0";
+
+        size_t content_length = 0;
+        while (std::getline(header, line))
+        {
+            const auto colon = line.find(':');
+            if (colon == std::string::npos)
+                continue;
+            const auto name = to_lower(trim(line.substr(0, colon)));
+            const auto value = to_lower(trim(line.substr(colon + 1)));
+            if (name == "content-length")
+            {
+                try
+                {
+                    content_length = std::stoull(value);
+                }
+                catch (const std::exception&)
+                {
+                    return 400;
+                }
+            }
+            else if (name == "connection")
+            {
+                if (value == "close")
+                    request.keep_alive = false;
+                else if (value == "keep-alive")
+                    request.keep_alive = true;
+            }
+            else if (name == "transfer-encoding")
+            {
+                return 411;
+            }
+        }
+        if (content_length > max_body_size)
+            return 413;
+        while (buffer.size() < content_length)
+        {
+            if (not receive(fd, buffer))
+                return 0;
+        }
+        request.body.assign(buffer, 0, content_length);
+        buffer.erase(0, content_length);
+        return 200;
+    }
+
+    // the value of a key=value parameter of the query string, or an empty string
+    auto get_parameter(const std::string& query, const std::string& key) -> std::string
+    {
+        std::istringstream sin(query);
+        std::string item;
+        while (std::getline(sin, item, '&'))
+        {
+            if (item.compare(0, key.size() + 1, key + "=") == 0)
+                return item.substr(key.size() + 1);
+        }
+        return "";
+    }
+
+    auto listen_unix(const std::string& path) -> int
+    {
+        sockaddr_un address{};
+        if (path.size() >= sizeof(address.sun_path))
+            throw std::runtime_error("ERROR: socket path too long: " + path);
+        address.sun_family = AF_UNIX;
+        std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+        const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            throw std::runtime_error("ERROR: socket: " + std::string(std::strerror(errno)));
+        // a previous server may have left its socket file behind
+        ::unlink(path.c_str());
+        if (::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 or
+            ::listen(fd, SOMAXCONN) < 0)
+        {
+            const std::string error = std::strerror(errno);
+            ::close(fd);
+            throw std::runtime_error("ERROR: could not listen on " + path + ": " + error);
+        }
+        return fd;
+    }
+
+    // only listens on the loopback interface: the server is not meant to be exposed
+    auto listen_tcp(const int port) -> int
+    {
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0)
+            throw std::runtime_error("ERROR: socket: " + std::string(std::strerror(errno)));
+        const int reuse = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 or
+            ::listen(fd, SOMAXCONN) < 0)
+        {
+            const std::string error = std::strerror(errno);
+            ::close(fd);
+            throw std::runtime_error(
+                "ERROR: could not listen on port " + std::to_string(port) + ": " + error);
+        }
+        return fd;
+    }
+}  // namespace
+
+auto main(const int argc, const char** argv) -> int
+try
+{
+    const auto num_threads = std::thread::hardware_concurrency();
+    const auto num_threads_str = std::to_string(num_threads);
+    command_line_parser parser;
+    parser.set_group_name("Detector Options");
+    parser.add_option("arch", "network architecture if not in the file (default: yolov7)", 1);
+    parser.add_option("conf", "default detection confidence threshold (default: 0.25)", 1);
+    parser.add_option("min-conf", "lowest threshold the requests can ask for (default: conf)", 1);
+    parser.add_option("dnn", "load this network file", 1);
+    parser.add_option("shared", "attach to the network published in shared memory as <arg>", 1);
+    parser.add_option("letterbox", "force letter box on inference");
+    parser.add_option("nms", "IoU and area covered thresholds (default: 0.45 1)", 2);
+    parser.add_option("no-classwise", "disable classwise NMS");
+    parser.add_option("nms-grid", "use the grid NMS, faster on crowded scenes");
+    parser.add_option("size", "image long side for inference (default: 512)", 1);
+
+    parser.set_group_name("Server Options");
+    parser.add_option("port", "listen on this localhost TCP port (default: 8080)", 1);
+    parser.add_option("socket", "listen on this Unix domain socket instead", 1);
+    parser.add_option("workers", "connection handlers (default: " + num_threads_str + ")", 1);
+    parser.add_option("batch", "maximum inference batch size (default: 8)", 1);
+    parser.add_option("delay", "maximum wait in ms to fill a batch (default: 5)", 1);
+    parser.add_option("max-size", "maximum image size in MiB (default: 32)", 1);
+    parser.add_option("timeout", "close idle connections after <arg> seconds (default: 30)", 1);
+
+    parser.set_group_name("Help Options");
+    parser.add_option("h", "alias for --help");
+    parser.add_option("help", "display this message and exit");
+    parser.parse(argc, argv);
+
+    if (parser.option("h") or parser.option("help"))
+    {
+        std::cout << "Usage: " << argv[0] << " --dnn NET [OPTION]…\n";
+        std::cout << "Serves the detections of encoded images over HTTP:\n";
+        std::cout << "  POST /detect[?conf=X] with the image file as body, returns JSON,\n";
+        std::cout << "    X from --min-conf to 1, rejected otherwise\n";
+        std::cout << "  GET /health returns the network information\n";
+        parser.print_options();
+        return EXIT_SUCCESS;
+    }
+
+    parser.check_incompatible_options("port", "socket");
+    parser.check_incompatible_options("dnn", "shared");
+    parser.check_option_arg_range<long>("size", 224, 8192);
+    parser.check_option_arg_range<double>("conf", 0, 1);
+    parser.check_option_arg_range<double>("min-conf", 0, 1);
+    parser.check_option_arg_range<double>("nms", 0, 1);
+    parser.check_option_arg_range<int>("port", 1, 65535);
+
+    const long image_size = get_option(parser, "size", 512);
+    const float conf_thresh = get_option(parser, "conf", 0.25);
+    const float min_conf_thresh = get_option(parser, "min-conf", conf_thresh);
+    const bool use_letterbox = parser.option("letterbox");
+    const std::string dnn_path = get_option(parser, "dnn", "");
+    const std::string shared_name = get_option(parser, "shared", "");
+    const std::string socket_path = get_option(parser, "socket", "");
+    const int port = get_option(parser, "port", 8080);
+    const size_t num_workers = std::max<size_t>(get_option(parser, "workers", num_threads), 1);
+    const size_t batch_size = get_option(parser, "batch", 8);
+    const long max_delay = get_option(parser, "delay", 5);
+    const size_t max_body_size = static_cast<size_t>(get_option(parser, "max-size", 32)) << 20;
+    const long timeout = get_option(parser, "timeout", 30);
+    const bool classwise_nms = not parser.option("no-classwise");
+    const auto nms = parser.option("nms-grid") ? nms_algorithm::grid : nms_algorithm::linear;
+    double nms_iou_threshold = 0.45;
+    double nms_ratio_covered = 1.0;
+    if (parser.option("nms"))
+    {
+        nms_iou_threshold = std::stod(parser.option("nms").argument(0));
+        nms_ratio_covered = std::stod(parser.option("nms").argument(1));
+    }
+    if (min_conf_thresh > conf_thresh)
+    {
+        std::cerr << "ERROR: --min-conf must not be above --conf\n";
+        return EXIT_FAILURE;
+    }
+    if (dnn_path.empty() and shared_name.empty())
+    {
+        std::cerr << "ERROR: specify the network to serve with --dnn or --shared\n";
+        return EXIT_FAILURE;
+    }
+
+    // The network is loaded and warmed up once, and stays in memory for all the requests
+    model net(get_option(parser, "arch", "yolov7"));
+    if (shared_name.empty())
+        net.load_infer(dnn_path);
+    else
+        net.load_shared(shared_name);
+    net.adjust_nms(nms_iou_threshold, nms_ratio_covered, classwise_nms, nms);
+    const auto stride = net.get_strides(image_size).back();
+    net.print_loss_details(std::clog);
+
+    // The handlers preprocess the images of their connections, and the engine groups the
+    // concurrent requests into mini-batches.  Some workers must be waiting on the engine for
+    // the batches to fill up, so there should be at least as many workers as the batch size.
+    // The engine keeps the detections down to the lowest threshold a request can ask for: the
+    // NMS only lets boxes suppress less confident ones, so filtering its output per request gives
+    // the same detections as running it at the threshold of the request.
+    inference_engine engine(
+        net,
+        batch_size,
+        std::chrono::milliseconds(max_delay),
+        min_conf_thresh);
+
+    const auto detect = [&](const http_request& request) -> json
+    {
+        const auto t0 = std::chrono::steady_clock::now();
+        float conf = conf_thresh;
+        if (const auto value = get_parameter(request.query, "conf"); not value.empty())
+        {
+            // strtof does not throw: out of range values become infinite, and are rejected below
+            char* end = nullptr;
+            conf = std::strtof(value.c_str(), &end);
+            if (end != value.c_str() + value.size())
+                throw std::invalid_argument("conf must be a number");
+        }
+        if (not(conf >= min_conf_thresh and conf <= 1))
+        {
+            throw std::invalid_argument(
+                "conf must be between " + std::to_string(min_conf_thresh) + " and 1");
+        }
+        const cv::Mat data(1, request.body.size(), CV_8UC1, (void*)request.body.data());
+        const cv::Mat decoded = cv::imdecode(data, cv::IMREAD_COLOR);
+        if (decoded.empty())
+            throw std::invalid_argument("could not decode the image");
+        rgb_image image, resized;
+        assign_image(image, cv_image<bgr_pixel>(decoded));
+        const auto tform = preprocess_image(image, resized, image_size, use_letterbox, stride);
+        auto detections = engine.submit(std::move(resized)).get();
+        postprocess_detections(tform, detections);
+
+        json result;
+        result["width"] = image.nc();
+        result["height"] = image.nr();
+        result["detections"] = json::array();
+        for (const auto& d : detections)
+        {
+            if (d.detection_confidence < conf)
+                continue;
+            result["detections"].push_back(
+                {{"label", d.label},
+                 {"confidence", d.detection_confidence},
+                 {"left", d.rect.left()},
+                 {"top", d.rect.top()},
+                 {"right", d.rect.right()},
+                 {"bottom", d.rect.bottom()}});
+        }
+        const auto t1 = std::chrono::steady_clock::now();
+        result["time_ms"] = std::chrono::duration_cast<fms>(t1 - t0).count();
+        return result;
+    };
+
+    // Serves the requests of a connection that has data to read.  Returns true if the connection
+    // stays open and has no complete request left, to wait for the next one without a worker.
+    const auto handle_connection = [&](connection& conn) -> bool
+    {
+        const int fd = conn.fd;
+        http_request request;
+        while (true)
+        {
+            const auto status = read_request(fd, conn.buffer, request, max_body_size);
+            if (status == 0)
+                return false;
+            if (status != 200)
+            {
+                send_response(fd, status, {{"error", get_reason(status)}}, false);
+                return false;
+            }
+            int code = 200;
+            json response;
+            if (request.path == "/detect")
+            {
+                if (request.method != "POST")
+                {
+                    code = 405;
+                    response = {{"error", "use POST with the image file as body"}};
+                }
+                else
+                {
+                    try
+                    {
+                        response = detect(request);
+                    }
+                    catch (const std::invalid_argument& e)
+                    {
+                        code = 400;
+                        response = {{"error", e.what()}};
+                    }
+                    catch (const std::exception& e)
+                    {
+                        code = 500;
+                        response = {{"error", e.what()}};
+                    }
+                }
+            }
+            else if (request.path == "/health")
+            {
+                response = {
+                    {"status", "ok"},
+                    {"architecture", net.get_architecture()},
+                    {"size", image_size},
+                    {"labels", net.get_options().labels}};
+            }
+            else
+            {
+                code = 404;
+                response = {{"error", "unknown path " + request.path}};
+            }
+            if (not send_response(fd, code, response, request.keep_alive) or
+                not request.keep_alive)
+                return false;
+            if (not has_request(conn.buffer))
+                return true;
+        }
+    };
+
+    // The workers only handle connections with a request to read.  Between requests, the
+    // connections wait in the poll set of the main thread, so that idle clients do not hold the
+    // workers, and the main thread closes them after the timeout.
+    const int listener = socket_path.empty() ? listen_tcp(port) : listen_unix(socket_path);
+    ::fcntl(listener, F_SETFL, ::fcntl(listener, F_GETFL) | O_NONBLOCK);
+    // the workers give the connections back to the main thread, and wake it up with this pipe
+    int wakeup[2];
+    if (::pipe(wakeup) < 0)
+        throw std::runtime_error("ERROR: pipe: " + std::string(std::strerror(errno)));
+    ::fcntl(wakeup[1], F_SETFL, ::fcntl(wakeup[1], F_GETFL) | O_NONBLOCK);
+    std::mutex returned_mutex;
+    std::vector<connection> returned;
+
+    dlib::pipe<connection> connections(4 * num_workers);
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < num_workers; ++i)
+    {
+        workers.emplace_back(
+            [&]()
+            {
+                connection conn;
+                while (connections.dequeue(conn))
+                {
+                    if (not handle_connection(conn))
+                    {
+                        ::close(conn.fd);
+                        continue;
+                    }
+                    {
+                        const std::lock_guard<std::mutex> lock(returned_mutex);
+                        returned.push_back(std::move(conn));
+                    }
+                    // if the pipe is full, the main thread is already going to wake up
+                    const char byte = 0;
+                    [[maybe_unused]] const auto n = ::write(wakeup[1], &byte, 1);
+                }
+            });
+    }
+    if (socket_path.empty())
+        std::clog << "listening on http://127.0.0.1:" << port << '\n';
+    else
+        std::clog << "listening on " << socket_path << '\n';
+
+    using clock = std::chrono::steady_clock;
+    struct idle_connection
+    {
+        connection conn;
+        clock::time_point since;
+    };
+    std::vector<idle_connection> idle;
+    std::vector<pollfd> fds;
+    // accept is paused for a while when the process is out of file descriptors or memory
+    auto accept_paused_until = clock::time_point();
+    std::string error;
+    while (error.empty())
+    {
+        {
+            const std::lock_guard<std::mutex> lock(returned_mutex);
+            for (auto& conn : returned)
+                idle.push_back({std::move(conn), clock::now()});
+            returned.clear();
+        }
+        const auto now = clock::now();
+        idle.erase(
+            std::remove_if(
+                idle.begin(),
+                idle.end(),
+                [&](const idle_connection& c)
+                {
+                    if (now - c.since < std::chrono::seconds(timeout))
+                        return false;
+                    ::close(c.conn.fd);
+                    return true;
+                }),
+            idle.end());
+
+        // poll ignores the negative descriptors
+        fds.clear();
+        fds.push_back({wakeup[0], POLLIN, 0});
+        fds.push_back({now < accept_paused_until ? -1 : listener, POLLIN, 0});
+        for (const auto& c : idle)
+            fds.push_back({c.conn.fd, POLLIN, 0});
+        if (::poll(fds.data(), fds.size(), 100) < 0)
+        {
+            if (errno != EINTR)
+                error = "ERROR: poll: " + std::string(std::strerror(errno));
+            continue;
+        }
+        if (fds[0].revents != 0)
+        {
+            char bytes[256];
+            [[maybe_unused]] const auto n = ::read(wakeup[0], bytes, sizeof(bytes));
+        }
+
+        // the connections with data, or closed by the client, go to the workers
+        size_t num_idle = 0;
+        for (size_t i = 0; i < idle.size(); ++i)
+        {
+            if (fds[i + 2].revents != 0)
+                connections.enqueue(idle[i].conn);
+            else
+                idle[num_idle++] = std::move(idle[i]);
+        }
+        idle.resize(num_idle);
+
+        if (fds[1].revents != 0)
+        {
+            const int fd = ::accept(listener, nullptr, nullptr);
+            if (fd >= 0)
+            {
+                // the receive timeout bounds the wait for the rest of a started request
+                const timeval tv{timeout, 0};
+                ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+                connection conn;
+                conn.fd = fd;
+                idle.push_back({std::move(conn), clock::now()});
+            }
+            else if (errno == EMFILE or errno == ENFILE or errno == ENOBUFS or errno == ENOMEM)
+            {
+                std::clog << "WARNING: accept: " << std::strerror(errno) << ", retrying\n";
+                accept_paused_until = clock::now() + std::chrono::milliseconds(100);
+            }
+            else if (errno != EINTR and errno != EAGAIN and errno != EWOULDBLOCK and
+                     errno != ECONNABORTED and errno != EPROTO)
+            {
+                error = "ERROR: accept: " + std::string(std::strerror(errno));
+            }
+        }
+    }
+
+    // the workers finish the requests in progress before the connections are closed
+    connections.disable();
+    for (auto& worker : workers)
+        worker.join();
+    for (const auto& c : idle)
+        ::close(c.conn.fd);
+    for (const auto& conn : returned)
+        ::close(conn.fd);
+    ::close(listener);
+    std::cerr << error << '\n';
+    return EXIT_FAILURE;
+}
+catch (const std::exception& e)
+{
+    std::cerr << e.what() << '\n';
+    return EXIT_FAILURE;
+}
@@ -1,27 +1,58 @@
 #include "sgd_trainer.h"
 
+#include "model_impl.h"
+
 using namespace dlib;
+
+template <typename NET> struct trainers
+{
+    std::unique_ptr<dnn_trainer<typename NET::train_type, sgd>> trainer;
+    std::unique_ptr<dnn_trainer<typename NET::infer_type, sgd>> loader;
+};
+
+template <typename... NETS>
+auto get_trainers_type(const std::variant<NETS...>&) -> std::variant<trainers<NETS>...>;
+
 struct sgd_trainer::impl
 {
     impl() = delete;
     ~impl() = default;
     impl(model& net, const float weight_decay, const float momentum, const std::vector<int> gpus)
-        : trainer(std::make_unique<dnn_trainer<net_train_type, sgd>>(
-              net.pimpl->train,
-              sgd(weight_decay, momentum),
-              gpus)),
-          loader(std::make_unique<dnn_trainer<net_infer_type, sgd>>(net.pimpl->infer))
     {
+        std::visit(
+            [&](auto& n)
+            {
+                trainers<std::decay_t<decltype(n)>> t;
+                t.trainer = std::make_unique<typename decltype(t.trainer)::element_type>(
+                    n.train,
+                    sgd(weight_decay, momentum),
+                    gpus);
+                t.loader = std::make_unique<typename decltype(t.loader)::element_type>(n.infer);
+                state = std::move(t);
+            },
+            net.pimpl->net);
     }
 
     impl(model& net)
-        : trainer(std::make_unique<dnn_trainer<net_train_type, sgd>>(net.pimpl->train)),
-          loader(std::make_unique<dnn_trainer<net_infer_type, sgd>>(net.pimpl->infer))
     {
+        std::visit(
+            [&](auto& n)
+            {
+                trainers<std::decay_t<decltype(n)>> t;
+                t.trainer = std::make_unique<typename decltype(t.trainer)::element_type>(n.train);
+                t.loader = std::make_unique<typename decltype(t.loader)::element_type>(n.infer);
+                state = std::move(t);
+            },
+            net.pimpl->net);
+    }
+
+    // calls f with the dnn_trainer of the current architecture
+    template <typename F> auto visit(F&& f)
+    {
+        return std::visit([&f](auto& t) { return f(*t.trainer); }, state);
     }
 
-    std::unique_ptr<dnn_trainer<net_train_type, sgd>> trainer;
-    std::unique_ptr<dnn_trainer<net_infer_type, sgd>> loader;
+    decltype(get_trainers_type(std::declval<networks>())) state;
 };
 
 sgd_trainer::~sgd_trainer() = default;
@@ -41,100 +72,108 @@ sgd_trainer::sgd_trainer(model& net) : pimpl(std::make_unique<sgd_trainer::impl>
 
 void sgd_trainer::be_verbose()
 {
-    pimpl->trainer->be_verbose();
+    pimpl->visit([&](auto& trainer) { trainer.be_verbose(); });
 }
 
 void sgd_trainer::be_quiet()
 {
-    pimpl->trainer->be_quiet();
+    pimpl->visit([&](auto& trainer) { trainer.be_quiet(); });
 }
 
 void sgd_trainer::print(std::ostream& out)
 {
-    out << *(pimpl->trainer.get()) << '\n';
+    pimpl->visit([&out](auto& trainer) { out << trainer << '\n'; });
 }
 
 void sgd_trainer::set_mini_batch_size(const size_t batch_size)
 {
-    pimpl->trainer->set_mini_batch_size(batch_size);
+    pimpl->visit([&](auto& trainer) { trainer.set_mini_batch_size(batch_size); });
 }
 
 size_t sgd_trainer::get_mini_batch_size() const
 {
-    return pimpl->trainer->get_mini_batch_size();
+    return pimpl->visit([&](auto& trainer) { return trainer.get_mini_batch_size(); });
 }
 
 void sgd_trainer::set_synchronization_file(const std::string& filename)
 {
-    pimpl->trainer->set_synchronization_file(filename, std::chrono::minutes(30));
+    pimpl->visit([&](auto& trainer)
+                 { trainer.set_synchronization_file(filename, std::chrono::minutes(30)); });
 }
 
 void sgd_trainer::load_from_synchronization_file(const std::string& filename)
 {
-    pimpl->loader->set_synchronization_file(filename);
-    pimpl->loader->get_net();
+    std::visit(
+        [&filename](auto& t)
+        {
+            t.loader->set_synchronization_file(filename);
+            t.loader->get_net();
+        },
+        pimpl->state);
 }
 
 void sgd_trainer::set_learning_rate(const double lr)
 {
-    pimpl->trainer->set_learning_rate(lr);
+    pimpl->visit([&](auto& trainer) { trainer.set_learning_rate(lr); });
 }
 
 double sgd_trainer::get_learning_rate() const
 {
-    return pimpl->trainer->get_learning_rate();
+    return pimpl->visit([&](auto& trainer) { return trainer.get_learning_rate(); });
 }
 
 void sgd_trainer::set_min_learning_rate(const double lr)
 {
-    pimpl->trainer->set_min_learning_rate(lr);
+    pimpl->visit([&](auto& trainer) { trainer.set_min_learning_rate(lr); });
 }
 
 double sgd_trainer::get_min_learning_rate() const
 {
-    return pimpl->trainer->get_min_learning_rate();
+    return pimpl->visit([&](auto& trainer) { return trainer.get_min_learning_rate(); });
 }
 
 void sgd_trainer::set_iterations_without_progress_threshold(const size_t threshold)
 {
-    pimpl->trainer->set_iterations_without_progress_threshold(threshold);
+    pimpl->visit([&](auto& trainer)
+                 { trainer.set_iterations_without_progress_threshold(threshold); });
 }
 
 void sgd_trainer::set_test_iterations_without_progress_threshold(const size_t threshold)
 {
-    pimpl->trainer->set_test_iterations_without_progress_threshold(threshold);
+    pimpl->visit([&](auto& trainer)
+                 { trainer.set_test_iterations_without_progress_threshold(threshold); });
 }
 
 void sgd_trainer::set_learning_rate_shrink_factor(const double shrink)
 {
-    pimpl->trainer->set_learning_rate_shrink_factor(shrink);
+    pimpl->visit([&](auto& trainer) { trainer.set_learning_rate_shrink_factor(shrink); });
 }
 
 void sgd_trainer::set_learning_rate_schedule(const dlib::matrix<double>& schedule)
 {
-    pimpl->trainer->set_learning_rate_schedule(schedule);
+    pimpl->visit([&](auto& trainer) { trainer.set_learning_rate_schedule(schedule); });
 }
 
 size_t sgd_trainer::get_train_one_step_calls() const
 {
-    return pimpl->trainer->get_train_one_step_calls();
+    return pimpl->visit([&](auto& trainer) { return trainer.get_train_one_step_calls(); });
 }
 
 void sgd_trainer::get_net(dlib::force_flush_to_disk force)
 {
-    pimpl->trainer->get_net(force);
+    pimpl->visit([&](auto& trainer) { trainer.get_net(force); });
 }
 
 void sgd_trainer::train_one_step(
     const std::vector<dlib::matrix<dlib::rgb_pixel>>& images,
     const std::vector<std::vector<dlib::yolo_rect>>& bboxes)
 {
-    pimpl->trainer->train_one_step(images, bboxes);
+    pimpl->visit([&](auto& trainer) { trainer.train_one_step(images, bboxes); });
 }
 
 void sgd_trainer::test_one_step(
     const std::vector<dlib::matrix<dlib::rgb_pixel>>& images,
     const std::vector<std::vector<dlib::yolo_rect>>& bboxes)
 {
-    pimpl->trainer->test_one_step(images, bboxes);
+    pimpl->visit([&](auto& trainer) { trainer.test_one_step(images, bboxes); });
 }
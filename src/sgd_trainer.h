@@ -2,7 +2,6 @@
 #define trainer_h_INCLUDED
 
 #include "model.h"
-#include "model_impl.h"
 
 class sgd_trainer
 {
@@ -18,11 +18,13 @@ try
     const auto num_threads = std::thread::hardware_concurrency();
     const auto num_threads_str = std::to_string(num_threads);
     command_line_parser parser;
+    parser.add_option("arch", "network architecture if not in the file (default: yolov7)", 1);
     parser.add_option("batch", "batch size for inference (default: 32)", 1);
     parser.add_option("conf", "detection confidence threshold (default: 0.25)", 1);
     parser.add_option("dnn", "load this network file", 1);
     parser.add_option("nms", "IoU and area covered ratio thresholds (default: 0.45 1)", 2);
     parser.add_option("nms-agnostic", "class-agnositc NMS");
+    parser.add_option("nms-grid", "use the grid NMS, faster on crowded scenes");
     parser.add_option("size", "image size for inference (default: 512)", 1);
     parser.add_option("sync", "load this sync file", 1);
     parser.add_option("workers", "number data loaders (default: " + num_threads_str + ")", 1);
@@ -49,6 +51,7 @@ try
     const fs::path dnn_path = get_option(parser, "dnn", "");
     const fs::path sync_path = get_option(parser, "sync", "");
     const bool classwise_nms = not parser.option("nms-agnostic");
+    const auto nms = parser.option("nms-grid") ? nms_algorithm::grid : nms_algorithm::linear;
     double iou_threshold = 0.45;
     double ratio_covered = 1.0;
     if (parser.option("nms"))
@@ -60,7 +63,7 @@ try
     bool export_model = false;
     size_t num_steps = 0;
 
-    model net;
+    model net(get_option(parser, "arch", "yolov7"));
     if (not dnn_path.empty())
     {
         net.load_infer(dnn_path);
@@ -79,7 +82,7 @@ try
         return EXIT_FAILURE;
     }
 
-    net.adjust_nms(iou_threshold, ratio_covered, classwise_nms);
+    net.adjust_nms(iou_threshold, ratio_covered, classwise_nms, nms);
     if (parser.option("architecture"))
         net.print(std::clog);
 
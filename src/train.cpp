@@ -1,6 +1,13 @@
+#include "allocation_counter.h"
+#include "augmentation.h"
 #include "detector_utils.h"
+#include "epoch_sampler.h"
+#include "image_cache.h"
 #include "metrics.h"
 #include "model.h"
+#include "packed_dataset.h"
+#include "pipeline_stats.h"
+#include "sample_pool.h"
 #include "sgd_trainer.h"
 
 #include <dlib/cmd_line_parser.h>
@@ -8,18 +15,33 @@
 #include <dlib/dnn.h>
 #include <dlib/gui_widgets.h>
 #include <dlib/image_io.h>
+#include <future>
 #include <tools/imglab/src/metadata_editor.h>
 
+#if defined(__linux__)
+#include <sys/resource.h>
+#endif
+
 using namespace dlib;
 
 using rgb_image = matrix<rgb_pixel>;
 
+// Lowers the scheduling priority of the calling thread, so that it only uses the CPU time left
+// by the training.  On Linux, the niceness is per thread and inherited by the threads it starts.
+void lower_thread_priority()
+{
+#if defined(__linux__)
+    setpriority(PRIO_PROCESS, 0, 10);
+#endif
+}
+
 int main(const int argc, const char** argv)
 try
 {
     const auto num_threads = std::thread::hardware_concurrency();
     const auto num_threads_str = std::to_string(num_threads);
     command_line_parser parser;
+    parser.add_option("arch", "network architecture (default: yolov7)", 1);
     parser.add_option("architecture", "print the network architecture");
     parser.add_option("name", "name used for net and sync files (default: yolo)", 1);
     parser.add_option("size", "image size for internal usage (default: 512)", 1);
@@ -33,6 +55,13 @@ try
     parser.add_option("gpus", "number of GPUs for the training (default: 1)", 1);
     parser.add_option("tune", "path to the network to fine-tune", 1);
     parser.add_option("workers", "number data loaders (default: " + num_threads_str + ")", 1);
+    parser.add_option("blocking-test", "pause the training while computing the epoch metrics");
+    parser.add_option("packed", "read the images from the shards written by pack_dataset");
+    parser.add_option("cache", "memory to cache the training images in MiB (default: 0)", 1);
+    parser.add_option("seed", "seed of the sampling and augmentations (default: time)", 1);
+    parser.add_option("balanced", "sample the training images with class-balanced weights");
+    parser.add_option("stats", "report the pipeline timings every <arg> steps (default: 0)", 1);
+    parser.add_option("stats-file", "also append them to a .csv or JSON lines file", 1);
 
     parser.set_group_name("Scheduler Options");
     parser.add_option("burnin", "use exponential burn-in (default: 1.0)", 1);
@@ -103,6 +132,7 @@ try
     parser.check_incompatible_options("backbone", "tune");
     parser.check_sub_option("epochs", "cosine");
     parser.check_sub_option("warmup", "burnin");
+    parser.check_sub_option("stats", "stats-file");
     const double learning_rate = get_option(parser, "learning-rate", 0.001);
     const double min_learning_rate = get_option(parser, "min-learning-rate", 1e-6);
     const double patience = get_option(parser, "patience", 3.0);
@@ -131,6 +161,9 @@ try
     const size_t test_period = get_option(parser, "test-period", 0);
     const size_t image_size = get_option(parser, "size", 512);
     const size_t num_workers = get_option(parser, "workers", num_threads);
+    const size_t cache_size = get_option(parser, "cache", 0);
+    const size_t stats_period = get_option(parser, "stats", 0);
+    const unsigned long random_seed = get_option(parser, "seed", time(nullptr));
     const double mirror_prob = get_option(parser, "mirror", 0.5);
     const double mosaic_prob = get_option(parser, "mosaic", 0.5);
     const double mixup_prob = get_option(parser, "mixup", 0.0);
@@ -150,6 +183,7 @@ try
     const std::string best_metrics_path = experiment_name + "_best_metrics.dat";
     const std::string backbone_path = get_option(parser, "backbone", "");
     const std::string tune_net_path = get_option(parser, "tune", "");
+    const std::string architecture = get_option(parser, "arch", "yolov7");
 
     // Path to the data directory containing training.xml and testing.xml
     const std::string data_path = parser[0];
@@ -197,9 +231,49 @@ try
     }
 
     std::clog << "# labels: " << class_support.size() << '\n';
+    std::clog << "# seed: " << random_seed << '\n';
+
+    // The loaders read the training images in shuffled blocks, the same ones for a given seed.
+    // With --balanced, an image is drawn proportionally to the inverse support of its rarest
+    // class, so that each epoch shows the rare classes more often.
+    epoch_sampler train_sampler(train_dataset.images.size(), random_seed);
+    if (parser.option("balanced"))
+    {
+        size_t max_support = 1;
+        for (const auto& [label, support] : class_support)
+            max_support = std::max(max_support, support);
+        std::vector<double> image_weights;
+        image_weights.reserve(train_dataset.images.size());
+        for (const auto& im : train_dataset.images)
+        {
+            double weight = 1.0 / max_support;
+            for (const auto& b : im.boxes)
+                weight = std::max(weight, 1.0 / class_support.at(b.label));
+            image_weights.push_back(weight);
+        }
+        train_sampler.set_weights(image_weights);
+    }
     image_dataset_metadata::dataset test_dataset;
     image_dataset_metadata::load_image_dataset_metadata(test_dataset, data_path + "/testing.xml");
     std::clog << "# test images: " << test_dataset.images.size() << '\n';
+    epoch_sampler test_sampler(test_dataset.images.size(), random_seed);
+
+    // The packed datasets hold the images already letterboxed, so that the loaders neither open
+    // nor decode any image file.
+    std::unique_ptr<packed_dataset> packed_train, packed_test;
+    if (parser.option("packed"))
+    {
+        packed_train = std::make_unique<packed_dataset>(data_path + "/training");
+        packed_train->check(train_dataset, image_size);
+        packed_test = std::make_unique<packed_dataset>(data_path + "/testing");
+        packed_test->check(test_dataset, image_size);
+    }
+
+    // The letterboxed training images are kept in memory, so that the popular ones, and the
+    // whole dataset if it fits, are not decoded again by each mosaic and each epoch.
+    std::unique_ptr<image_cache> train_cache;
+    if (cache_size > 0)
+        train_cache = std::make_unique<image_cache>(cache_size << 20);
 
     // YOLO options
     yolo_options options;
@@ -256,7 +330,7 @@ try
         throw std::length_error("ERROR: wrong or missing pyramid level specified in anchor.");
     }
 
-    model net(options);
+    model net(options, architecture);
     if (parser.option("architecture"))
     {
         rgb_image dummy(image_size, image_size);
@@ -319,19 +393,35 @@ try
         return EXIT_SUCCESS;
     }
 
-    dlib::pipe<std::pair<rgb_image, std::vector<yolo_rect>>> test_data(10 * batch_size / num_gpus);
-    const auto test_loader = [&test_data, &test_dataset, &data_path, image_size](time_t seed)
+    dlib::pipe<training_sample> test_data(10 * batch_size / num_gpus);
+    const auto test_loader =
+        [&test_data, &test_dataset, &test_sampler, &packed_test, &data_path, image_size]()
     {
-        dlib::rand rnd(time(nullptr) + seed);
+        std::vector<size_t> block;
+        size_t next = 0;
         while (test_data.is_enabled())
         {
-            const auto idx = rnd.get_random_64bit_number() % test_dataset.images.size();
+            if (next == block.size())
+            {
+                test_sampler.get_block(block);
+                next = 0;
+            }
+            const auto idx = block[next++];
             std::pair<rgb_image, std::vector<yolo_rect>> sample;
             rgb_image image;
+            rectangle_transform tform;
             const auto& image_info = test_dataset.images.at(idx);
             try
             {
-                load_image(image, data_path + "/" + image_info.filename);
+                if (packed_test)
+                {
+                    tform = packed_test->load(idx, sample.first);
+                }
+                else
+                {
+                    load_image(image, data_path + "/" + image_info.filename);
+                    tform = letterbox_image(image, sample.first, image_size);
+                }
             }
             catch (const image_load_error& e)
             {
@@ -342,7 +432,6 @@ try
                 test_data.enqueue(sample);
                 continue;
             }
-            const rectangle_transform tform = letterbox_image(image, sample.first, image_size);
             for (const auto& box : image_info.boxes)
                 sample.second.emplace_back(tform(box.rect), 1, box.label);
             test_data.enqueue(sample);
@@ -350,35 +439,80 @@ try
     };
 
     // Create some data loaders which will load the data, and perform some data augmentation.
-    dlib::pipe<std::pair<rgb_image, std::vector<yolo_rect>>> train_data(100 * batch_size);
+    // The buffers of the samples go around between the loaders and the trainer through a pool,
+    // and each loader reuses its own scratch buffers, so that no memory is allocated once the
+    // pipeline is warm, at least when the images all have the same size, as in a packed dataset.
+    dlib::pipe<training_sample> train_data(100 * batch_size);
+    sample_pool train_pool(train_data.max_size() + 2 * batch_size);
+    std::atomic<size_t> loader_samples{0};
+    std::atomic<size_t> loader_allocations{0};
+    pipeline_stats stats(get_option(parser, "stats-file", ""));
+    stats.set_capacity(pipeline_stats::train_queue, train_data.max_size());
+    stats.set_capacity(pipeline_stats::test_queue, test_data.max_size());
     const auto train_loader = [&](time_t seed)
     {
-        dlib::rand rnd(time(nullptr) + seed);
-        const auto get_sample = [&](const bool downscale = true)
+        dlib::rand rnd(random_seed + seed);
+        std::vector<size_t> block;
+        size_t next = 0;
+        auto decoded = std::make_shared<cached_image>();
+        training_sample mix1, mix2, tile, sample;
+        const auto get_sample = [&](training_sample& result, const bool downscale = true)
         {
-            std::pair<rgb_image, std::vector<yolo_rect>> result;
-            rgb_image image, letterbox, transformed(image_size, image_size);
-            const auto idx = rnd.get_random_64bit_number() % train_dataset.images.size();
-            const auto& image_info = train_dataset.images.at(idx);
-            try
+            result.second.clear();
+            if (next == block.size())
             {
-                load_image(image, data_path + "/" + image_info.filename);
+                train_sampler.get_block(block);
+                next = 0;
             }
-            catch (const image_load_error& e)
+            const auto idx = block[next++];
+            const auto& image_info = train_dataset.images.at(idx);
+            // The source image, with the transform from the original image to the letterbox.  It
+            // is already letterboxed when it comes from the cache or the packed dataset.
+            // Otherwise, the letterbox is part of the single warp done below.
+            std::shared_ptr<const cached_image> source;
+            point_transform_affine source_to_letterbox;
             {
-                std::cerr << "ERROR: " << e.what() << std::endl;
-                result.first.set_size(image_size, image_size);
-                assign_all_pixels(result.first, rgb_pixel(0, 0, 0));
-                result.second = {};
-                return result;
+                const auto timer = stats.time(pipeline_stats::load);
+                if (train_cache)
+                    source = train_cache->get(idx);
+                if (not source)
+                {
+                    // the cached images are kept, so they need their own buffers
+                    auto loaded = train_cache ? std::make_shared<cached_image>() : decoded;
+                    try
+                    {
+                        if (packed_train)
+                        {
+                            loaded->tform = packed_train->load(idx, loaded->image);
+                        }
+                        else if (train_cache)
+                        {
+                            rgb_image image;
+                            load_image(image, data_path + "/" + image_info.filename);
+                            loaded->tform = letterbox_image(image, loaded->image, image_size);
+                        }
+                        else
+                        {
+                            load_image(loaded->image, data_path + "/" + image_info.filename);
+                            loaded->tform = get_letterbox_transform(
+                                loaded->image.nr(),
+                                loaded->image.nc(),
+                                image_size);
+                            source_to_letterbox = loaded->tform;
+                        }
+                    }
+                    catch (const image_load_error& e)
+                    {
+                        std::cerr << "ERROR: " << e.what() << std::endl;
+                        result.first.set_size(image_size, image_size);
+                        assign_all_pixels(result.first, rgb_pixel(0, 0, 0));
+                        return;
+                    }
+                    if (train_cache)
+                        train_cache->put(idx, loaded);
+                    source = std::move(loaded);
+                }
             }
-            for (const auto& box : image_info.boxes)
-                result.second.emplace_back(box.rect, class_weights.at(box.label), box.label);
-
-            // First, letterbox the image
-            rectangle_transform tform(letterbox_image(image, letterbox, image_size));
-            for (auto& box : result.second)
-                box.rect = tform(box.rect);
 
             // Scale, shift and rotate
             double scale = 1.0;
@@ -396,39 +530,63 @@ try
                 centered_drect(center, image_size * scale, image_size * scale),
                 {image_size, image_size},
                 rnd.get_double_in_range(-angle * pi / 180, angle * pi / 180));
-
-            extract_image_chip(letterbox, chip, result.first);
-            tform = get_mapping_to_chip(chip);
-            for (auto& box : result.second)
-                box.rect = tform(box.rect);
+            auto affine = get_mapping_to_chip(chip);
 
             // Mirroring
             if (rnd.get_random_double() < mirror_prob)
-            {
-                tform = flip_image_left_right(result.first);
-                for (auto& box : result.second)
-                    box.rect = tform(box.rect);
-            }
+                affine = point_transform_affine({-1, 0, 0, 1}, {image_size - 1., 0}) * affine;
 
             // Perspective
+            point_transform_projective perspective;
             if (perspective_frac > 0)
             {
-                const drectangle r = get_rect(result.first);
-                std::array ps{r.tl_corner(), r.tr_corner(), r.bl_corner(), r.br_corner()};
+                const drectangle r(0, 0, image_size - 1, image_size - 1);
+                const std::array corners{
+                    r.tl_corner(),
+                    r.tr_corner(),
+                    r.bl_corner(),
+                    r.br_corner()};
+                auto ps = corners;
                 const double perspective_amount = perspective_frac * image_size;
                 for (auto& corner : ps)
                 {
                     corner.x() += rnd.get_double_in_range(-perspective_amount, perspective_amount);
                     corner.y() += rnd.get_double_in_range(-perspective_amount, perspective_amount);
                 }
-                const auto ptform = extract_image_4points(result.first, transformed, ps);
-                result.first = transformed;
+                perspective = get_perspective_transform(ps, corners);
+            }
+
+            // All the geometric transforms are composed, and the source is resampled only once
+            const point_transform_projective to_output(affine * source_to_letterbox);
+            {
+                const auto timer = stats.time(pipeline_stats::warp);
+                warp_image(
+                    source->image,
+                    inv(perspective * to_output),
+                    result.first,
+                    image_size,
+                    image_size);
+            }
+
+            // The boxes go through the same transforms: the affine part keeps their area, like
+            // rectangle_transform does, and the perspective takes the bounding box of the corners.
+            const rectangle_transform tform(affine * source->tform);
+            for (const auto& box : image_info.boxes)
+            {
+                result.second.emplace_back(
+                    tform(box.rect),
+                    class_weights.at(box.label),
+                    box.label);
+            }
+            if (perspective_frac > 0)
+            {
                 for (auto& box : result.second)
                 {
-                    ps[0] = ptform(box.rect.tl_corner());
-                    ps[1] = ptform(box.rect.tr_corner());
-                    ps[2] = ptform(box.rect.bl_corner());
-                    ps[3] = ptform(box.rect.br_corner());
+                    const std::array ps{
+                        perspective(box.rect.tl_corner()),
+                        perspective(box.rect.tr_corner()),
+                        perspective(box.rect.bl_corner()),
+                        perspective(box.rect.br_corner())};
                     const auto lr = std::minmax({ps[0].x(), ps[1].x(), ps[2].x(), ps[3].x()});
                     const auto tb = std::minmax({ps[0].y(), ps[1].y(), ps[2].y(), ps[3].y()});
                     box.rect.left() = lr.first;
@@ -439,7 +597,10 @@ try
             }
 
             // Color data augmentation
-            disturb_colors(result.first, rnd, color_gamma, color_magnitude);
+            {
+                const auto timer = stats.time(pipeline_stats::color);
+                disturb_colors(result.first, rnd, color_gamma, color_magnitude);
+            }
 
             // Ignore or remove boxes that are not well covered by the current image
             const auto image_rect = get_rect(result.first);
@@ -475,76 +636,65 @@ try
                     box.rect.bottom() = put_in_range(0, image_size, box.rect.bottom());
                 }
             }
-
-            return result;
         };
 
-        const auto mixup = [&rnd, &class_weights, get_sample](const bool downscale = true)
+        const auto mixup = [&](training_sample& result, const bool downscale = true)
         {
-            const auto sample1 = get_sample(downscale);
-            const auto sample2 = get_sample(downscale);
-            std::pair<rgb_image, std::vector<yolo_rect>> sample;
-            DLIB_CASSERT(have_same_dimensions(sample1.first, sample2.first));
-            sample.first.set_size(sample1.first.nr(), sample1.first.nc());
+            get_sample(mix1, downscale);
+            get_sample(mix2, downscale);
+            result.second.clear();
             const auto alpha = rnd.get_random_beta(8, 8);
-            for (long r = 0; r < sample.first.nr(); ++r)
-            {
-                for (long c = 0; c < sample.first.nc(); ++c)
-                {
-                    sample.first(r, c).red =
-                        alpha * sample1.first(r, c).red + (1 - alpha) * sample2.first(r, c).red;
-                    sample.first(r, c).green = alpha * sample1.first(r, c).green +
-                                               (1 - alpha) * sample2.first(r, c).green;
-                    sample.first(r, c).blue =
-                        alpha * sample1.first(r, c).blue + (1 - alpha) * sample2.first(r, c).blue;
-                }
-            }
-            for (auto box : sample1.second)
+            const auto timer = stats.time(pipeline_stats::mixup);
+            blend_images(mix1.first, mix2.first, alpha, result.first);
+            for (auto& box : mix1.second)
             {
                 box.detection_confidence = alpha * class_weights.at(box.label);
-                sample.second.push_back(std::move(box));
+                result.second.push_back(std::move(box));
             }
-            for (auto box : sample2.second)
+            for (auto& box : mix2.second)
             {
                 box.detection_confidence = (1 - alpha) * class_weights.at(box.label);
-                sample.second.push_back(std::move(box));
+                result.second.push_back(std::move(box));
             }
-            return sample;
         };
 
         while (train_data.is_enabled())
         {
+            const auto allocations = get_thread_allocations();
+            const auto sample_start = pipeline_stats::clock::now();
+            train_pool.get(sample);
             if (rnd.get_random_double() < mosaic_prob)
             {
                 const long s = image_size * 0.5;
-                std::pair<rgb_image, std::vector<yolo_rect>> sample;
                 sample.first.set_size(image_size, image_size);
-                const std::vector<std::pair<long, long>> pos{{0, 0}, {0, s}, {s, 0}, {s, s}};
+                const std::array<std::pair<long, long>, 4> pos{{{0, 0}, {0, s}, {s, 0}, {s, s}}};
                 for (const auto& [x, y] : pos)
                 {
-                    std::pair<rgb_image, std::vector<yolo_rect>> tile;
                     if (rnd.get_random_double() < mixup_prob)
-                        tile = mixup(false);
+                        mixup(tile, false);
                     else
-                        tile = get_sample(false);
-                    const rectangle r(x, y, x + s, y + s);
-                    auto si = sub_image(sample.first, r);
-                    resize_image(tile.first, si);
+                        get_sample(tile, false);
+                    const auto timer = stats.time(pipeline_stats::mosaic);
+                    resize_into(tile.first, sample.first, rectangle(x, y, x + s, y + s));
                     for (auto& box : tile.second)
                     {
                         box.rect = translate_rect(scale_rect(box.rect, 0.5), x, y);
                         sample.second.push_back(std::move(box));
                     }
                 }
-                train_data.enqueue(sample);
             }
             else
             {
                 if (rnd.get_random_double() < mixup_prob)
-                    train_data.enqueue(mixup(true));
+                    mixup(sample, true);
                 else
-                    train_data.enqueue(get_sample(true));
+                    get_sample(sample, true);
             }
+            loader_allocations += get_thread_allocations() - allocations;
+            ++loader_samples;
+            stats.add(pipeline_stats::sample, pipeline_stats::clock::now() - sample_start);
+            const auto timer = stats.time(pipeline_stats::enqueue);
+            train_data.enqueue(sample);
         }
     };
 
@@ -556,7 +706,7 @@ try
     if (test_period > 0)
     {
         for (size_t i = 0; i < 2; ++i)
-            test_data_loaders.emplace_back([test_loader, i]() { test_loader(i + 1); });
+            test_data_loaders.emplace_back(test_loader);
     }
 
     // It is always a good idea to visualize the training samples.  By passing the --visualize
@@ -594,34 +744,43 @@ try
 
     std::vector<rgb_image> images;
     std::vector<std::vector<yolo_rect>> bboxes;
+    training_sample sample;
 
     // The main training loop, that we will reuse for the warmup and the rest of the training.
-    const auto train = [&images, &bboxes, &train_data, &test_data, &trainer, test_period]()
+    // The samples are swapped into the mini-batch, and their buffers go back to the loaders as
+    // soon as the trainer has copied them to the network input.
+    // With --stats, the timings of the pipeline are reported every few steps.
+    const auto train = [&]()
     {
         static size_t train_cnt = 0;
-        images.clear();
-        bboxes.clear();
-        std::pair<rgb_image, std::vector<yolo_rect>> sample;
-        if (test_period == 0 or ++train_cnt % test_period != 0)
+        const auto mini_batch_size = trainer.get_mini_batch_size();
+        const bool test_step = test_period > 0 and ++train_cnt % test_period == 0;
+        auto& data = test_step ? test_data : train_data;
+        stats.measure(pipeline_stats::train_queue, train_data.size());
+        if (test_period > 0)
+            stats.measure(pipeline_stats::test_queue, test_data.size());
+        images.resize(mini_batch_size);
+        bboxes.resize(mini_batch_size);
         {
-            while (images.size() < trainer.get_mini_batch_size())
+            const auto timer = stats.time(pipeline_stats::dequeue);
+            for (size_t i = 0; i < mini_batch_size; ++i)
             {
-                train_data.dequeue(sample);
-                images.push_back(std::move(sample.first));
-                bboxes.push_back(std::move(sample.second));
+                data.dequeue(sample);
+                images[i].swap(sample.first);
+                bboxes[i].swap(sample.second);
             }
-            trainer.train_one_step(images, bboxes);
         }
-        else
         {
-            while (images.size() < trainer.get_mini_batch_size())
-            {
-                test_data.dequeue(sample);
-                images.push_back(std::move(sample.first));
-                bboxes.push_back(std::move(sample.second));
-            }
-            trainer.test_one_step(images, bboxes);
+            const auto timer = stats.time(pipeline_stats::step);
+            if (test_step)
+                trainer.test_one_step(images, bboxes);
+            else
+                trainer.train_one_step(images, bboxes);
         }
+        for (size_t i = 0; i < mini_batch_size; ++i)
+            train_pool.put(images[i], bboxes[i]);
+        if (stats_period > 0 and train_cnt % stats_period == 0)
+            stats.report(trainer.get_train_one_step_calls(), std::clog);
     };
 
     const auto num_steps_per_epoch = train_dataset.images.size() / trainer.get_mini_batch_size();
@@ -709,47 +868,97 @@ try
     size_t best_epoch = 0;
     if (file_exists(best_metrics_path))
         deserialize(best_metrics_path) >> best_metrics >> best_epoch;
+
+    // The metrics of each epoch are computed on a snapshot of the network, in the background and
+    // with a lower priority, while the training goes on.  Only one snapshot is evaluated at a
+    // time: if it is not done by the end of the next epoch, the training waits for it.
+    const bool blocking_test = parser.option("blocking-test");
+    model test_net;
+    size_t test_epoch = 0;
+    size_t test_steps = 0;
+    std::future<metrics_details> test_metrics;
+    const auto compute_test_metrics = [&]()
+    {
+        if (not blocking_test)
+            lower_thread_priority();
+        test_net.sync();
+        dlib::pipe<image_info> data(1000);
+        test_data_loader test_loader(
+            parser[0],
+            test_dataset,
+            data,
+            image_size,
+            num_workers,
+            packed_test.get());
+        std::thread test_loaders([&test_loader]() { test_loader.run(); });
+        const auto metrics = compute_metrics(
+            test_net,
+            test_dataset,
+            2 * batch_size / num_gpus,
+            data,
+            test_conf,
+            std::clog);
+        data.disable();
+        test_loaders.join();
+        test_net.clean();
+        return metrics;
+    };
+    const auto finish_test = [&]()
+    {
+        const auto metrics = test_metrics.get();
+        if (metrics.map > best_metrics.map)
+        {
+            save_model(test_net, experiment_name, test_steps, metrics);
+            serialize(best_metrics_path) << metrics << test_epoch;
+            best_metrics = metrics;
+            best_epoch = test_epoch;
+        }
+
+        std::cout << "\n"
+                  << "           mAP    mPr    mRc    mF1    µPr    µRc    µF1    wPr    wRc "
+                     "   wF1     AP   AP50   AP75    APs    APm    APl\n";
+        std::cout << "EPOCH " << test_epoch << ": " << std::fixed << std::setprecision(4)
+                  << metrics << "\n\n"
+                  << std::flush;
+    };
+
     while (trainer.get_learning_rate() >= trainer.get_min_learning_rate())
     {
         train();
+        if (test_metrics.valid() and
+            test_metrics.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+            finish_test();
+
         const auto num_steps = trainer.get_train_one_step_calls();
         if (num_steps % num_steps_per_epoch == 0)
         {
+            if (test_metrics.valid())
+                finish_test();
             trainer.get_net();
-            net.sync();
-            const auto epoch = num_steps / num_steps_per_epoch;
-            std::cerr << "computing mean average precison for epoch " << epoch << std::endl;
-            dlib::pipe<image_info> data(1000);
-            test_data_loader test_loader(parser[0], test_dataset, data, image_size, num_workers);
-            std::thread test_loaders([&test_loader]() { test_loader.run(); });
-            const auto metrics = compute_metrics(
-                net,
-                test_dataset,
-                2 * batch_size / num_gpus,
-                data,
-                test_conf,
-                std::clog);
-
-            if (metrics.map > best_metrics.map)
+            test_net = net;
+            test_steps = num_steps;
+            test_epoch = num_steps / num_steps_per_epoch;
+            std::cerr << "computing mean average precison for epoch " << test_epoch << std::endl;
+            const double num_samples = std::max<size_t>(loader_samples, 1);
+            std::cerr << "loader allocations per sample: " << loader_allocations / num_samples
+                      << std::endl;
+            loader_allocations = 0;
+            loader_samples = 0;
+            if (train_cache)
             {
-                save_model(net, experiment_name, num_steps, metrics);
-                serialize(best_metrics_path) << metrics << epoch;
-                best_metrics = metrics;
-                best_epoch = epoch;
+                const auto lookups = train_cache->get_hits() + train_cache->get_misses();
+                std::cerr << "image cache: " << (train_cache->get_num_bytes() >> 20) << '/'
+                          << (train_cache->get_max_bytes() >> 20) << " MiB, hit rate: "
+                          << 100.0 * train_cache->get_hits() / std::max<size_t>(lookups, 1)
+                          << "%" << std::endl;
             }
-
-            std::cout << "\n"
-                      << "           mAP    mPr    mRc    mF1    µPr    µRc    µF1    wPr    wRc "
-                         "   wF1\n";
-            std::cout << "EPOCH " << epoch << ": " << std::fixed << std::setprecision(4) << metrics
-                      << "\n\n"
-                      << std::flush;
-
-            data.disable();
-            test_loaders.join();
-            net.clean();
+            test_metrics = std::async(std::launch::async, compute_test_metrics);
+            if (blocking_test)
+                finish_test();
         }
     }
+    if (test_metrics.valid())
+        finish_test();
 
     trainer.get_net();
     trainer.print(std::cout);
@@ -757,7 +966,7 @@ try
 
     std::cout << "\n"
               << "           mAP    mPr    mRc    mF1    µPr    µRc    µF1    wPr    wRc "
-                 "   wF1\n";
+                 "   wF1     AP   AP50   AP75    APs    APm    APl\n";
     std::cout << "EPOCH " << best_epoch << ": " << std::fixed << std::setprecision(4)
               << best_metrics << std::endl;
 
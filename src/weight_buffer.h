@@ -0,0 +1,50 @@
+#ifndef weight_buffer_h_INCLUDED
+#define weight_buffer_h_INCLUDED
+
+#include <cstddef>
+#include <dlib/assert.h>
+#include <vector>
+
+// An array of weights that either owns its values, or refers to values owned by someone else,
+// for example a file mapped in memory, that must outlive the buffer and its copies.  The values
+// referred to are read-only.
+template <typename T> class weight_buffer
+{
+    public:
+    auto data() const -> const T* { return view ? view : storage.data(); }
+    auto data() -> T*
+    {
+        DLIB_CASSERT(view == nullptr, "the weights refer to read-only memory");
+        return storage.data();
+    }
+    auto size() const -> size_t { return view ? view_size : storage.size(); }
+    auto empty() const -> bool { return size() == 0; }
+    auto is_view() const -> bool { return view != nullptr; }
+    auto operator[](const size_t i) const -> const T& { return data()[i]; }
+
+    void assign(const size_t size, const T& value)
+    {
+        view = nullptr;
+        storage.assign(size, value);
+    }
+
+    void resize(const size_t size)
+    {
+        view = nullptr;
+        storage.resize(size);
+    }
+
+    void set_view(const T* values, const size_t size)
+    {
+        storage = std::vector<T>();
+        view = values;
+        view_size = size;
+    }
+
+    private:
+    std::vector<T> storage;
+    const T* view = nullptr;
+    size_t view_size = 0;
+};
+
+#endif  // weight_buffer_h_INCLUDED
@@ -1,6 +1,8 @@
 #ifndef yolov5_h_INCLUDED
 #define yolov5_h_INCLUDED
 
+#include "qcon.h"
+
 #include <dlib/dnn.h>
 
 namespace yolov5
@@ -19,14 +21,15 @@ namespace yolov5
         long depth_num = 1,
         long depth_den = 1,
         long width_num = 1,
-        long width_den = 1
+        long width_den = 1,
+        template <long, long, long, int, int, int, int> class CON = con_
     >
     struct def
     {
         static constexpr long nf = 64 * width_num / width_den;
 
         template <long NF, int KS, int S, typename SUBNET>
-        using conv = ACT<BN<add_layer<con_<NF, KS, KS, S, S, (KS-1)/2, (KS-1)/2>, SUBNET>>>;
+        using conv = ACT<BN<add_layer<CON<NF, KS, KS, S, S, (KS-1)/2, (KS-1)/2>, SUBNET>>>;
 
         template <long NF, typename SUBNET>
         using bottleneck = conv<NF, 3, 1, conv<NF, 1, 1, SUBNET>>;
@@ -99,14 +102,19 @@ namespace yolov5
 
     using train_type_n = def<leaky_relu, bn_con, 1, 3, 1, 4>::net_type;
     using infer_type_n = def<leaky_relu, affine, 1, 3, 1, 4>::net_type;
+    using quant_type_n = def<leaky_relu, affine, 1, 3, 1, 4, qcon_>::net_type;
     using train_type_s = def<leaky_relu, bn_con, 1, 3, 1, 2>::net_type;
     using infer_type_s = def<leaky_relu, affine, 1, 3, 1, 2>::net_type;
+    using quant_type_s = def<leaky_relu, affine, 1, 3, 1, 2, qcon_>::net_type;
     using train_type_m = def<leaky_relu, bn_con, 2, 3, 3, 4>::net_type;
     using infer_type_m = def<leaky_relu, affine, 2, 3, 3, 4>::net_type;
+    using quant_type_m = def<leaky_relu, affine, 2, 3, 3, 4, qcon_>::net_type;
     using train_type_l = def<leaky_relu, bn_con, 1, 1, 1, 1>::net_type;
     using infer_type_l = def<leaky_relu, affine, 1, 1, 1, 1>::net_type;
+    using quant_type_l = def<leaky_relu, affine, 1, 1, 1, 1, qcon_>::net_type;
     using train_type_x = def<leaky_relu, bn_con, 4, 3, 5, 4>::net_type;
     using infer_type_x = def<leaky_relu, affine, 4, 3, 5, 4>::net_type;
+    using quant_type_x = def<leaky_relu, affine, 4, 3, 5, 4, qcon_>::net_type;
 }
 
 #endif // yolov5_h_INCLUDED
@@ -1,6 +1,8 @@
 #ifndef yolov7_h_INCLUDED
 #define yolov7_h_INCLUDED
 
+#include "qcon.h"
+
 #include <dlib/dnn.h>
 
 namespace yolov7
@@ -15,12 +17,16 @@ namespace yolov7
     template <typename SUBNET> using ntag4 = add_tag_layer<5004, SUBNET>;
     template <typename SUBNET> using ntag5 = add_tag_layer<5005, SUBNET>;
 
-    template <template <typename> class ACT, template <typename> class BN>
+    template <
+        template <typename> class ACT,
+        template <typename> class BN,
+        template <long, long, long, int, int, int, int> class CON = con_
+    >
     struct def
     {
 
         template <long NF, int KS, int S, typename SUBNET>
-        using conv = ACT<BN<add_layer<con_<NF, KS, KS, S, S, (KS-1)/2, (KS-1)/2>, SUBNET>>>;
+        using conv = ACT<BN<add_layer<CON<NF, KS, KS, S, S, (KS-1)/2, (KS-1)/2>, SUBNET>>>;
 
         template <long NF, typename SUBNET>
         using transition = concat2<itag2, itag1,
@@ -109,6 +115,7 @@ namespace yolov7
 
     using train_type = def<silu, bn_con>::net_type;
     using infer_type = def<silu, affine>::net_type;
+    using quant_type = def<silu, affine, qcon_>::net_type;
 }
 
 #endif // yolov7_h_INCLUDED
@@ -1,6 +1,8 @@
 #ifndef yolov7_tiny_h_INCLUDED
 #define yolov7_tiny_h_INCLUDED
 
+#include "qcon.h"
+
 #include <dlib/dnn.h>
 
 namespace yolov7_tiny
@@ -15,12 +17,16 @@ namespace yolov7_tiny
     template <typename SUBNET> using ntag4 = add_tag_layer<5004, SUBNET>;
     template <typename SUBNET> using ntag5 = add_tag_layer<5005, SUBNET>;
 
-    template <template <typename> class ACT, template <typename> class BN>
+    template <
+        template <typename> class ACT,
+        template <typename> class BN,
+        template <long, long, long, int, int, int, int> class CON = con_
+    >
     struct def
     {
 
         template <long NF, int KS, int S, typename SUBNET>
-        using conv = ACT<BN<add_layer<con_<NF, KS, KS, S, S, (KS-1)/2, (KS-1)/2>, SUBNET>>>;
+        using conv = ACT<BN<add_layer<CON<NF, KS, KS, S, S, (KS-1)/2, (KS-1)/2>, SUBNET>>>;
 
         template <long NF, typename SUBNET>
         using e_elan = conv<NF, 1, 1,
@@ -81,6 +87,7 @@ namespace yolov7_tiny
 
     using train_type = def<leaky_relu, bn_con>::net_type;
     using infer_type = def<leaky_relu, affine>::net_type;
+    using quant_type = def<leaky_relu, affine, qcon_>::net_type;
 }
 
 #endif // yolov7_tiny_h_INCLUDED